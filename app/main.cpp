@@ -1,19 +1,82 @@
+#include "filteredjson/file.hpp"
 #include "filteredjson/json.hpp"
+#include "filteredjson/parallel.hpp"
 #include "filteredjson/parser.hpp"
+#include "filteredjson/writer.hpp"
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <vector>
 
-int main()
+// usage: filteredjson_app [-n] [-j threads] [file]
+// parses a JSON document from file, or stdin, and pretty prints it
+// with -n the input holds newline delimited records, each printed compact on its own line
+// with -j the records are parsed on that many threads (0 for all cores),
+// and the throughput is reported on stderr
+int main(int argc, char **argv)
 {
-  std::string str;
+  bool records = false;
+  int threads = -1;
+  std::string path;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string_view arg{argv[i]};
+    if (arg == "-n")
+      records = true;
+    else if (arg == "-j" && i + 1 < argc)
+      threads = std::atoi(argv[++i]), records = true;
+    else
+      path = arg;
+  }
+  FilteredJSON::StreamWriter out{std::cout};
+  if (threads >= 0)
+  {
+    FilteredJSON::MappedFile file;
+    std::string buffered;
+    if (path.empty() || !file.open(path))
+      buffered.assign(std::istreambuf_iterator<char>{std::cin}, {});
+    std::string_view input = file.isOpen() ? file.view() : buffered;
+    FilteredJSON::ParallelParser parallel{nullptr, unsigned(threads)};
+    auto start = std::chrono::steady_clock::now();
+    bool valid = parallel.parse(input, out);
+    out.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << parallel.threads() << " threads: " << input.size() / 1e6 / elapsed.count() << " MB/s" << std::endl;
+    return valid ? 0 : 1;
+  }
   FilteredJSON::Parser parser;
-  while (std::cin.peek() != EOF)
+  if (records)
+  {
+    parser.setMultiDocument(true, [&](FilteredJSON::Value &root) {
+      root.serialize(out);
+      out.put('\n');
+    });
+  }
+  if (!path.empty())
+  {
+    if (!parser.parseFile(path))
+      return 1;
+  }
+  else
   {
-    std::getline(std::cin, str);
-    parser.parseContinue(str);
+    // read in blocks, the parser resumes wherever a block ends
+    std::vector<char> buffer(64 * 1024);
+    // and stops reading once the filter can keep nothing more
+    while (std::cin.read(buffer.data(), buffer.size()) || std::cin.gcount())
+      if (parser.parseContinue({buffer.data(), size_t(std::cin.gcount())}).done)
+        break;
+    parser.finish();
   }
+  if (records)
+    return parser.isValid() ? 0 : 1;
   FilteredJSON::Value &root = parser.getValue();
   std::cout << "Root type: " << (int)root.getType() << std::endl;
-  std::cout << "Root stringified: " << root.stringify(0) << std::endl;
+  std::cout << "Root stringified: ";
+  root.serialize(out, 0);
+  out.flush();
+  std::cout << std::endl;
   return 0;
-}
\ No newline at end of file
+}
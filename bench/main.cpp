@@ -0,0 +1,443 @@
+#include "filteredjson/fanout.hpp"
+#include "filteredjson/filter.hpp"
+#include "filteredjson/json.hpp"
+#include "filteredjson/parser.hpp"
+#include "filteredjson/writer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// usage: filteredjson_bench [-s MB] [-t seconds] [-o results.json]
+// generates each corpus locally (about MB megabytes, 4 by default) and times
+// full parses, filtered parses, stringify, parseContinue() chunk sizes and fan-out,
+// each repeated for at least seconds (0.2 by default), reporting the best run.
+// results are written as JSON to the file or stdout, a summary goes to stderr
+// configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers
+
+// counting allocator hook: every heap allocation of the process goes through here
+static std::atomic<size_t> allocations{0};
+static std::atomic<size_t> allocatedBytes{0};
+
+void *operator new(size_t n)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(n, std::memory_order_relaxed);
+  if (void *p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void *operator new(size_t n, std::align_val_t align)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(n, std::memory_order_relaxed);
+  size_t a = size_t(align);
+  if (void *p = std::aligned_alloc(a, (std::max<size_t>(n, 1) + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new[](size_t n, std::align_val_t align) { return operator new(n, align); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace
+{
+  using namespace FilteredJSON;
+
+  struct Corpus
+  {
+    std::string name;
+    std::string text;
+    size_t documents = 1; // records of an NDJSON corpus
+  };
+
+  struct Result
+  {
+    std::string corpus;
+    std::string benchmark;
+    std::string variant;
+    size_t bytes;
+    double seconds; // best run
+    size_t runs;
+    double allocations; // per document, of the last run
+    double allocatedBytes;
+  };
+
+  // corpora, generated from a fixed seed so every run sees the same input
+  class Generator
+  {
+  public:
+    std::string word()
+    {
+      static const char *words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "json", "stream", "filter",
+                                    "parse", "caf\\u00e9", "na\xc3\xafve", "tweet", "value", "key"};
+      return words[m_rng() % std::size(words)];
+    }
+    std::string sentence(size_t words)
+    {
+      std::string s;
+      for (size_t i = 0; i < words; i++)
+        s += (i ? " " : "") + word();
+      return s;
+    }
+    uint64_t integer(uint64_t bound) { return m_rng() % bound; }
+    std::string number()
+    {
+      char buffer[32];
+      std::snprintf(buffer, sizeof buffer, "%.*f", int(m_rng() % 15 + 1),
+                    std::uniform_real_distribution<double>{-180, 180}(m_rng));
+      return buffer;
+    }
+
+  private:
+    std::mt19937_64 m_rng{20240901};
+  };
+
+  std::string twitter(Generator &g, size_t size)
+  {
+    std::string s = "[";
+    while (s.size() < size)
+    {
+      std::string id = std::to_string(250075927172759552ull + g.integer(1ull << 40));
+      std::string user = std::to_string(g.integer(1ull << 31));
+      if (s.size() > 1)
+        s += ',';
+      s += R"({"created_at":"Mon Sep 24 03:35:21 +0000 2012","id":)" + id + R"(,"id_str":")" + id +
+           R"(","text":")" + g.sentence(12) + R"( \"quoted\" 😀","source":"<a href=\"http:\/\/example.com\" rel=\"nofollow\">)" +
+           g.word() + R"(<\/a>","truncated":false,"in_reply_to_status_id":null,"user":{"id":)" + user +
+           R"(,"name":")" + g.sentence(2) + R"(","screen_name":"user)" + user + R"(","location":")" + g.word() +
+           R"(","followers_count":)" + std::to_string(g.integer(100000)) + R"(,"verified":)" +
+           (g.integer(10) ? "false" : "true") + R"(,"profile_image_url":"http:\/\/a0.example.com\/profile_images\/)" + user +
+           R"(.png"},"geo":null,"coordinates":null,"retweet_count":)" + std::to_string(g.integer(1000)) +
+           R"(,"favorited":false,"entities":{"hashtags":[{"text":")" + g.word() + R"(","indices":[)" +
+           std::to_string(g.integer(70)) + "," + std::to_string(70 + g.integer(70)) +
+           R"(]}],"urls":[],"user_mentions":[]},"lang":"en"})";
+    }
+    return s + "]";
+  }
+
+  std::string numeric(Generator &g, size_t size)
+  {
+    std::string s = R"({"type":"FeatureCollection","features":[)";
+    while (s.size() < size)
+    {
+      if (s.back() != '[')
+        s += ',';
+      s += R"({"type":"Feature","properties":{"id":)" + std::to_string(g.integer(1000000)) + R"(,"v":)" + g.number() +
+           R"(},"geometry":{"type":"Polygon","coordinates":[[)";
+      for (int i = 0; i < 200; i++)
+        s += (i ? ",[" : "[") + g.number() + "," + g.number() + "]";
+      s += "]]}}";
+    }
+    return s + "]}";
+  }
+
+  std::string deep(Generator &g, size_t size)
+  {
+    std::string s = "[";
+    while (s.size() < size)
+    {
+      if (s.size() > 1)
+        s += ',';
+      int depth = 32 + g.integer(96);
+      for (int i = 0; i < depth; i++)
+        s += i % 2 ? "[" : R"({"k":)";
+      s += std::to_string(g.integer(100));
+      for (int i = depth; i-- > 0;)
+        s += i % 2 ? "]" : "}";
+    }
+    return s + "]";
+  }
+
+  Corpus ndjson(Generator &g, size_t size)
+  {
+    Corpus c{"ndjson", {}, 0};
+    static const char *levels[] = {"debug", "info", "warn", "error"};
+    while (c.text.size() < size)
+    {
+      c.text += R"({"ts":)" + std::to_string(1700000000000ull + g.integer(1ull << 30)) + R"(,"level":")" +
+                levels[g.integer(4)] + R"(","msg":")" + g.sentence(8) + R"(","fields":{"req":)" +
+                std::to_string(g.integer(1ull << 20)) + R"(,"ms":)" + g.number() + "}}\n";
+      c.documents++;
+    }
+    return c;
+  }
+
+  std::string strings(Generator &g, size_t size)
+  {
+    std::string s = "[";
+    while (s.size() < size)
+    {
+      if (s.size() > 1)
+        s += ',';
+      s += '"';
+      size_t length = 1024 + g.integer(4096);
+      for (size_t start = s.size(); s.size() - start < length;)
+      {
+        static const char *escapes[] = {"\\n", "\\\"", "\\\\", "\\t", "\\u00e9", "\\/"};
+        s += g.sentence(4);
+        s += escapes[g.integer(std::size(escapes))];
+      }
+      s += '"';
+    }
+    return s + "]";
+  }
+
+  class Bench
+  {
+  public:
+    Bench(double minTime) : m_minTime{minTime} {}
+
+    // run f until minTime has passed, at least 3 times, keeping the best time
+    void measure(const Corpus &corpus, const std::string &benchmark, const std::string &variant,
+                 const std::function<void()> &f)
+    {
+      f(); // warm up, also lets arenas and buffers reach their steady size
+      double best = 1e300;
+      double total = 0;
+      size_t runs = 0;
+      size_t counted = 0, bytes = 0;
+      while (runs < 3 || total < m_minTime)
+      {
+        size_t a = allocations.load(), b = allocatedBytes.load();
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        counted = allocations.load() - a;
+        bytes = allocatedBytes.load() - b;
+        best = std::min(best, elapsed.count());
+        total += elapsed.count();
+        runs++;
+      }
+      Result r{corpus.name, benchmark, variant, corpus.text.size(), best, runs,
+               double(counted) / corpus.documents, double(bytes) / corpus.documents};
+      std::fprintf(stderr, "%-8s %-10s %-24s %9.1f MB/s %10.2f allocs/doc\n", r.corpus.c_str(), r.benchmark.c_str(),
+                   r.variant.c_str(), r.bytes / 1e6 / r.seconds, r.allocations);
+      m_results.push_back(std::move(r));
+    }
+
+    void write(std::ostream &out) const
+    {
+      StreamWriter json{out};
+      json.write("[");
+      for (size_t i = 0; i < m_results.size(); i++)
+      {
+        const Result &r = m_results[i];
+        char numbers[256];
+        std::snprintf(numbers, sizeof numbers,
+                      R"(,"bytes":%zu,"seconds":%.9f,"runs":%zu,"mb_per_s":%.3f,"allocations_per_doc":%.3f,"allocated_bytes_per_doc":%.1f})",
+                      r.bytes, r.seconds, r.runs, r.bytes / 1e6 / r.seconds, r.allocations, r.allocatedBytes);
+        json.write(i ? ",\n " : "\n ");
+        json.write(R"({"corpus":)");
+        String{std::string{r.corpus}}.serialize(json);
+        json.write(R"(,"benchmark":)");
+        String{std::string{r.benchmark}}.serialize(json);
+        json.write(R"(,"variant":)");
+        String{std::string{r.variant}}.serialize(json);
+        json.write(numbers);
+      }
+      json.write("\n]\n");
+      json.flush();
+    }
+
+  private:
+    double m_minTime;
+    std::vector<Result> m_results;
+  };
+} // namespace
+
+int main(int argc, char **argv)
+{
+  size_t size = 4;
+  double minTime = 0.2;
+  std::string output;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    std::string_view arg{argv[i]};
+    if (arg == "-s")
+      size = std::strtoul(argv[i + 1], nullptr, 10);
+    else if (arg == "-t")
+      minTime = std::strtod(argv[i + 1], nullptr);
+    else if (arg == "-o")
+      output = argv[i + 1];
+  }
+  size = std::max<size_t>(size, 1) * 1000 * 1000;
+
+  Generator g;
+  std::vector<Corpus> corpora;
+  corpora.push_back({"twitter", twitter(g, size)});
+  corpora.push_back({"numeric", numeric(g, size)});
+  corpora.push_back({"deep", deep(g, size)});
+  corpora.push_back(ndjson(g, size));
+  corpora.push_back({"strings", strings(g, size)});
+  {
+    // the twitter corpus indented, mostly whitespace between tokens
+    Parser pretty;
+    pretty.parseAll(corpora[0].text);
+    corpora.push_back({"pretty", pretty.getValue().stringify(2)});
+  }
+
+  Bench bench{minTime};
+  Parser parser;
+  BufferWriter text{size * 2};
+  for (const Corpus &corpus : corpora)
+  {
+    bool records = corpus.documents > 1;
+    parser.setFilter(nullptr);
+    parser.setMultiDocument(records, [](Value &) {});
+    for (bool indexed : {false, true})
+    {
+      parser.useStructuralIndex(indexed);
+      bench.measure(corpus, "parse", indexed ? "full, indexed" : "full", [&] {
+        if (!parser.parseAll(corpus.text))
+          std::abort();
+      });
+    }
+    parser.useStructuralIndex(false);
+    // a reused parser's document keeps its grown buffer, a new one starts small
+    bench.measure(corpus, "parse", "full, new parser", [&] {
+      Parser cold;
+      cold.setMultiDocument(records, [](Value &) {});
+      if (!cold.parseAll(corpus.text))
+        std::abort();
+    });
+    if (records)
+      continue;
+    parser.parseAll(corpus.text);
+    bench.measure(corpus, "stringify", "compact", [&] {
+      text.clear();
+      parser.getValue().serialize(text);
+    });
+  }
+
+  // selectivities from a single key per record to most of each record
+  struct Selection
+  {
+    size_t corpus;
+    const char *filter;
+  };
+  for (Selection s : {Selection{0, ".[0].id"}, Selection{0, ".[].id"}, Selection{0, ".[] | {id, text, name: .user.name}"},
+                      Selection{0, ".[].user"}, Selection{1, ".features[].properties.v"},
+                      Selection{2, ".[].k"}, Selection{3, ".level"}, Selection{3, "{ts, fields}"},
+                      Selection{3, "select(.level == \"error\") | {ts, msg}"}, Selection{4, ".[10]"}})
+  {
+    const Corpus &corpus = corpora[s.corpus];
+    std::unique_ptr<Filter> filter = Filter::from_string(s.filter);
+    if (!filter)
+      std::abort();
+    parser.setMultiDocument(corpus.documents > 1, [](Value &) {});
+    parser.setFilter(filter.get());
+    bench.measure(corpus, "filter", s.filter, [&] {
+      if (!parser.parseAll(corpus.text))
+        std::abort();
+    });
+  }
+
+  // parseContinue() copies strings and resumes tokens split across chunks
+  const Corpus &corpus = corpora[0];
+  parser.setMultiDocument(false);
+  parser.setFilter(nullptr);
+  for (size_t chunk : {64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024})
+  {
+    bench.measure(corpus, "chunks", std::to_string(chunk) + " bytes", [&] {
+      parser.reset();
+      for (size_t i = 0; i < corpus.text.size(); i += chunk)
+        parser.parseContinue(std::string_view{corpus.text}.substr(i, chunk));
+      parser.finish();
+      if (!parser.isValid())
+        std::abort();
+    });
+  }
+
+  // consumers of the ndjson corpus, each with its own filter, in one pass or one pass each
+  {
+    const Corpus &records = corpora[3];
+    std::vector<std::unique_ptr<Filter>> filters;
+    for (const char *expression : {".level", ".ts", ".fields.req", ".fields.ms", "{ts, msg}",
+                                   "select(.level == \"error\") | .msg", "select(.fields.req < 1000)", ".msg"})
+      filters.push_back(Filter::from_string(expression));
+    Handler sink;
+    FanOut fanout;
+    for (auto &filter : filters)
+      fanout.add(filter.get(), sink);
+    fanout.setMultiDocument(true);
+    std::string variant = std::to_string(filters.size()) + " filters";
+    bench.measure(records, "fanout", variant + ", one pass", [&] {
+      if (!fanout.parseAll(records.text))
+        std::abort();
+    });
+    Parser single{sink};
+    single.setMultiDocument(true);
+    bench.measure(records, "fanout", variant + ", a pass each", [&] {
+      for (auto &filter : filters)
+      {
+        single.setFilter(filter.get());
+        if (!single.parseAll(records.text))
+          std::abort();
+      }
+    });
+  }
+
+  // filtered JSON written out, by building and serializing the kept values or passing them through
+  for (Selection s : {Selection{0, ".[].user"}, Selection{3, "{ts, fields}"}})
+  {
+    const Corpus &corpus = corpora[s.corpus];
+    std::unique_ptr<Filter> filter = Filter::from_string(s.filter);
+    if (!filter)
+      std::abort();
+    bool records = corpus.documents > 1;
+    Parser built{*filter};
+    built.setMultiDocument(records, [&](Value &root) {
+      root.serialize(text);
+      text.put('\n');
+    });
+    bench.measure(corpus, "passthrough", std::string{s.filter} + ", build and serialize", [&] {
+      text.clear();
+      if (!built.parseAll(corpus.text))
+        std::abort();
+      if (!records)
+      {
+        built.getValue().serialize(text);
+        text.put('\n');
+      }
+    });
+    Parser passed{*filter};
+    passed.setMultiDocument(records);
+    passed.setPassthrough(&text);
+    bench.measure(corpus, "passthrough", std::string{s.filter} + ", passed through", [&] {
+      text.clear();
+      if (!passed.parseAll(corpus.text))
+        std::abort();
+    });
+  }
+
+  if (output.empty())
+  {
+    bench.write(std::cout);
+  }
+  else
+  {
+    std::ofstream out{output};
+    bench.write(out);
+  }
+  return 0;
+}
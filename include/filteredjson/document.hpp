@@ -0,0 +1,86 @@
+#pragma once
+
+#include "json.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Owns a parsed value tree and the arena it is allocated from.
+     * Objects, arrays and strings built with allocator() come from a monotonic
+     * arena, so clear() frees the whole tree in a single release without
+     * walking it. The arena's first buffer grows to the largest document seen,
+     * so a Document reused for similar documents stops calling malloc.
+     * Values copied out of the document are allocated on the heap and stay
+     * valid after clear(); moved out values do not. Values moved or copied
+     * into the tree must come from allocator(), anything else would leak on
+     * clear(), see Value.
+     * Sub-documents build values on other threads that move into this tree
+     * without a copy, see subDocument().
+    */
+    class Document{
+    public:
+        Document(size_t initialSize = 64 * 1024);
+        ~Document();
+        Document(const Document &) = delete;
+        Document &operator=(const Document &) = delete;
+
+        Value &root() { return m_root; }
+        const Value &root() const { return m_root; }
+        Allocator allocator() { return Allocator{&*m_arena}; }
+        std::pmr::memory_resource *resource() { return &*m_arena; }
+        size_t capacity() const { return m_bufferSize; }
+        /**
+         * @brief Heap blocks taken since construction, first buffer included.
+        */
+        size_t allocations() const { return m_upstream.blocks; }
+        /**
+         * @brief Frees the tree and every sub-document.
+        */
+        void clear();
+        /**
+         * @brief A new Document owned by this one.
+         * Its arena compares equal to this Document's, so its values are moved
+         * into this tree rather than copied. It lives until this Document is
+         * cleared, and may be filled on another thread until then.
+        */
+        Document &subDocument(size_t initialSize = 64 * 1024);
+    private:
+        // arena equal to the arenas of the other Documents in its group,
+        // monotonic arenas never free single allocations, so any of them
+        // may "deallocate" what another handed out
+        class Arena final : public std::pmr::monotonic_buffer_resource{
+        public:
+            Arena(void *buffer, size_t size, std::pmr::memory_resource *upstream, const Document *group)
+                : monotonic_buffer_resource{buffer, size, upstream}, m_group{group} {}
+        private:
+            const Document *m_group;
+            bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+        };
+        // tracks what the arena needs beyond its first buffer
+        class Upstream final : public std::pmr::memory_resource{
+        public:
+            size_t allocated = 0;
+            size_t blocks = 0;      //> allocations since construction
+        private:
+            void *do_allocate(size_t bytes, size_t alignment) override;
+            void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+            bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+        };
+        Upstream m_upstream;
+        std::unique_ptr<std::byte[]> m_buffer;
+        size_t m_bufferSize;
+        const Document *m_group = this;     //> outermost Document of the group
+        std::optional<Arena> m_arena;
+        std::vector<std::unique_ptr<Document>> m_subDocuments;
+        Value m_root;
+
+        Document(size_t initialSize, const Document *group);
+        void forgetRoot();
+    };
+} // namespace FilteredJSON
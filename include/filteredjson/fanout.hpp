@@ -0,0 +1,117 @@
+#pragma once
+
+#include "filter.hpp"
+#include "handler.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Parses the input once for many consumers, each with a Filter and
+     * a Handler of its own.
+     * The FanOut is the Filter and Handler of a single Parser. For each open
+     * value it keeps the consumers keeping it, with their filters, so a key or
+     * element is parsed if any of them keeps it, skipped unread if none does,
+     * and each event only goes to the consumers keeping its value. The input is
+     * tokenized once and the work grows with the union of what is kept, not
+     * with the number of consumers.
+     * Each consumer's events are those of a Parser with its filter alone, also
+     * for select()s, though a value one consumer drops is still parsed for the
+     * others.
+    */
+    class FanOut final : private Filter, private Handler{
+    public:
+        FanOut() = default;
+        FanOut(const FanOut &) = delete;
+        FanOut &operator=(const FanOut &) = delete;
+        /**
+         * @brief Adds a consumer, a nullptr filter keeps everything.
+         * filter and handler must outlive the FanOut. Resets the parse.
+        */
+        void add(const Filter *filter, Handler &handler);
+        size_t consumers() const { return m_consumers.size(); }
+        /**
+         * @brief See Parser::setMultiDocument(), every consumer gets
+         * Handler::onDocumentEnd() for each record. Resets the parse.
+        */
+        void setMultiDocument(bool enable);
+        void reset();
+        /**
+         * @brief See Parser::parseContinue(), the parse is done once no
+         * consumer can keep anything more.
+        */
+        Parser::Status parseContinue(std::string_view data);
+        /**
+         * @brief See Parser::parseAll(), strings may view input during the
+         * events.
+        */
+        bool parseAll(std::string_view input);
+        bool parseFile(const std::string &path);
+        void finish();
+        bool isValid() const { return m_parser.isValid(); }
+        bool isDone() const { return m_parser.isDone(); }
+    private:
+        struct Consumer{
+            const Filter *filter;
+            Handler *handler;
+            Handler *output;        //> handler, or the innermost open Selection
+            std::vector<std::unique_ptr<Selection>> selections; //> reused, the first depths.size() are open
+            std::vector<size_t> depths;                         //> levels open around each selected value
+            bool dropped = false;   //> a select() dropped the root
+        };
+        // a consumer keeping a value, and its filter for it
+        struct Route{
+            uint32_t consumer;
+            const Filter *filter;
+        };
+        // an open object or array, routes of m_routes from first on
+        struct Level{
+            size_t first;
+            bool array;
+            int keyLimit;
+            int indexLimit;
+            bool prefiltered;       //> every consumer has a prefilter
+            KeyPrefilter prefilter; //> of all consumers
+        };
+        Identity m_keepAll;
+        std::vector<Consumer> m_consumers;
+        std::vector<Route> m_roots;
+        std::vector<Route> m_routes;
+        std::vector<Level> m_levels;
+        //consumers keeping the next value, found by the parser's keepKey()
+        //or keepIdx() call just before its events
+        mutable std::vector<Route> m_next;
+        bool m_keyed = false;       //> the next value's key was sent
+        Parser m_parser{static_cast<Handler &>(*this), static_cast<const Filter &>(*this)};
+
+        void beginValue();
+        void beginSelections();
+        void endSelections(const Route *begin, const Route *end);
+        void pushLevel(bool array);
+        void popLevel();
+
+        const Filter *keep(const Value &) const override { return this; }
+        const Filter *keepKey(std::string_view key) const override;
+        const Filter *keepIdx(int idx) const override;
+        int keyLimit() const override { return m_levels.back().keyLimit; }
+        int indexLimit() const override { return m_levels.back().indexLimit; }
+        const KeyPrefilter *keyPrefilter() const override;
+
+        void onObjectStart() override;
+        void onKey(std::string_view key, bool copy) override;
+        void onObjectEnd() override;
+        void onArrayStart() override;
+        void onArrayEnd() override;
+        void onString(std::string_view value, bool copy) override;
+        void onNumber(Number value) override;
+        void onBoolean(bool value) override;
+        void onNull() override;
+        void onDocumentEnd() override;
+    };
+} // namespace FilteredJSON
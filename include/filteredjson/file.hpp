@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Read-only view of a whole regular file.
+     * The file is memory mapped and advised for one sequential pass
+     * (MADV_SEQUENTIAL, MADV_WILLNEED and huge pages where available), so
+     * parsing it copies nothing. Without mmap the file is read into memory.
+    */
+    class MappedFile{
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(MappedFile &&f) noexcept;
+        MappedFile &operator=(MappedFile &&f) noexcept;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        /**
+         * @brief Maps path, closing what was open before.
+         * @return false if path is not a regular file or can't be mapped,
+         * pipes and devices have to be read instead
+        */
+        bool open(const std::string &path);
+        void close();
+        bool isOpen() const { return m_open; }
+        std::string_view view() const { return {m_data, m_size}; }
+    private:
+        const char *m_data = nullptr;
+        size_t m_size = 0;
+        bool m_open = false;
+        bool m_mapped = false;
+        std::string m_copy;     //> contents when mmap is not available
+    };
+
+    /**
+     * @brief Reads path in blocks of blockSize, handing each block to
+     * callback, for inputs that can't be mapped.
+     * @return false if path can't be opened or read
+    */
+    bool readBlocks(const std::string &path, size_t blockSize, const std::function<void(std::string_view)> &callback);
+} // namespace FilteredJSON
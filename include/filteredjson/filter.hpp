@@ -1,13 +1,140 @@
 #pragma once
 
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
 #include "json.hpp"
 
 namespace FilteredJSON
 {
+  namespace detail
+  {
+    /**
+     * @brief Up to 8 bytes of p as a little endian word, zero padded.
+    */
+    constexpr uint64_t loadWord(const char *p, size_t n) {
+      if (!std::is_constant_evaluated() && n == 8 && std::endian::native == std::endian::little) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        return w;
+      }
+      uint64_t w = 0;
+      for (size_t i = 0; i < n; i++)
+        w |= uint64_t(uint8_t(p[i])) << 8 * i;
+      return w;
+    }
+
+    /**
+     * @brief Hash of a key's length and its first and last 8 bytes, so
+     * keys up to 16 bytes are hashed whole and longer ones in O(1).
+     * The matched key is still compared in full.
+    */
+    constexpr uint32_t keyHash(std::string_view key, uint32_t seed) {
+      size_t n = key.size();
+      uint64_t a = loadWord(key.data(), n < 8 ? n : 8);
+      uint64_t b = n > 8 ? loadWord(key.data() + n - (n < 16 ? n - 8 : 8), n < 16 ? n - 8 : 8) : 0;
+      uint64_t h = (a ^ (seed + 1) * 0x9E3779B97F4A7C15ull) * 0xFF51AFD7ED558CCDull;
+      h ^= (b + n) * 0xC4CEB9FE1A85EC53ull;
+      h ^= h >> 29;
+      h *= 0x94D049BB133111EBull;
+      return uint32_t(h ^ h >> 32);
+    }
+
+    /**
+     * @brief Size of the perfect hash table for keys keys, a power of 2.
+    */
+    constexpr size_t perfectSlots(size_t keys) {
+      return keys ? std::bit_ceil(4 * keys) : 0;
+    }
+
+    /**
+     * @brief Finds a seed for which keyHash() puts every key in its own slot
+     * of a table of size slots (a power of 2).
+     * @return the seed, or -1 if none of the tried seeds separates the keys
+    */
+    template<typename Keys>
+    constexpr int perfectSeed(const Keys &keys, size_t slots) {
+      for (int seed = 0; seed < 256; seed++) {
+        std::vector<bool> used(slots);
+        bool perfect = true;
+        for (std::string_view key : keys) {
+          size_t slot = keyHash(key, seed) & (slots - 1);
+          if (used[slot]) {
+            perfect = false;
+            break;
+          }
+          used[slot] = true;
+        }
+        if (perfect)
+          return seed;
+      }
+      return -1;
+    }
+  } // namespace detail
+
+  /**
+   * @brief The first bytes and the longest length of the keys a filter keeps,
+   * lets the Parser rule a key out while it is still reading it.
+  */
+  struct KeyPrefilter {
+    uint64_t firsts[4] = {};  //> bit per first byte
+    size_t maxLength = 0;
+
+    constexpr void add(std::string_view key) {
+      if (!key.empty())
+        firsts[uint8_t(key.front()) >> 6] |= 1ull << (uint8_t(key.front()) & 63);
+      maxLength = key.size() > maxLength ? key.size() : maxLength;
+    }
+    constexpr void add(const KeyPrefilter &other) {
+      for (int i = 0; i < 4; i++)
+        firsts[i] |= other.firsts[i];
+      maxLength = other.maxLength > maxLength ? other.maxLength : maxLength;
+    }
+    constexpr bool mayStartWith(char c) const {
+      return firsts[uint8_t(c) >> 6] >> (uint8_t(c) & 63) & 1;
+    }
+  };
+
+  /**
+   * @brief Condition a select() puts on the value at path below the
+   * selected value, e.g. `.level == "error"` or `.msg | startswith("GET")`.
+   * Numbers compare with numbers and strings with strings, comparing other
+   * types only ever holds for `!=`. A missing value is tested as null.
+  */
+  struct Predicate {
+    enum Op {
+      Exists,       //> present and neither null nor false
+      Equal,
+      NotEqual,
+      Less,
+      LessEqual,
+      Greater,
+      GreaterEqual,
+      Prefix,       //> a string starting with string
+    };
+    Op op = Exists;
+    std::vector<std::string> path;  //> keys from the selected value
+    Type type = Type::Null;         //> of the operand
+    std::string string;
+    Number number;
+    bool boolean = false;
+
+    bool test(std::string_view value) const;
+    bool test(Number value) const;
+    bool test(bool value) const;
+    bool testNull() const;
+    bool testContainer() const { return op == Exists || op == NotEqual; }
+    bool operator==(const Predicate &other) const;
+  };
+
+  class SelectFilter;
 
   enum FilterState{
     DISCARD,
@@ -15,20 +142,75 @@ namespace FilteredJSON
     CONTINUE,
   };
 
+  /**
+   * @brief Base of the filter tree consulted by the Parser.
+   * keepKey()/keepIdx() return the filter to apply to the child value,
+   * or nullptr if the child should be discarded (and skipped unparsed).
+  */
   class Filter{
   public:
-    // static Filter from_string(const std::string &str);
+    virtual ~Filter() = default;
+    /**
+     * @brief Compiles a jq-like filter expression into a Filter tree.
+     * Supported: `.`, `.a.b`, `."a b"`, `.["a"]`, `.items[]`, `.items[3]`,
+     * unions `.a, .b`, pipes `.items[] | .id`, grouping `(...)` and
+     * projections `{a, b: .c.d}` which keep key `b` filtered by `.c.d`,
+     * and `select(cond and ...)` keeping only the values meeting every cond,
+     * one of `.path`, `.path OP literal` with OP `==`, `!=`, `<`, `<=`, `>`
+     * or `>=`, and `.path | startswith("text")`, see SelectFilter.
+     * Common prefixes are merged and duplicate keys collapsed,
+     * so one parse pass evaluates every projection at once.
+     * @return the filter, or nullptr if the expression is malformed
+    */
+    static std::unique_ptr<Filter> from_string(std::string_view str);
+    /**
+     * @brief Compiles many expressions into a single merged Filter tree,
+     * equivalent to joining them with ','.
+     * @return the filter, or nullptr if any expression is malformed
+    */
+    static std::unique_ptr<Filter> from_strings(const std::vector<std::string> &strs);
     virtual const Filter *keep(const Value &) const = 0;
-    virtual const Filter *keepKey(const std::string &s) const { return nullptr; };
+    virtual const Filter *keepKey(std::string_view s) const { return nullptr; };
     virtual const Filter *keepIdx(int idx) const { return nullptr; };
+    /**
+     * @brief Number of keys keepKey() can keep, or -1 if unbounded.
+     * Once that many have been kept the rest of an object is skipped,
+     * keys are assumed to appear only once.
+    */
+    virtual int keyLimit() const { return -1; }
+    /**
+     * @brief Index from which keepIdx() keeps nothing, or -1 if unbounded.
+     * The rest of an array from that index on is skipped.
+    */
+    virtual int indexLimit() const { return -1; }
+    /**
+     * @brief Prefilter of the keys keepKey() can keep, or nullptr if any
+     * key may be kept.
+    */
+    virtual const KeyPrefilter *keyPrefilter() const { return nullptr; }
+    /**
+     * @brief The select() deciding whether the value is kept at all, or
+     * nullptr if it is kept unconditionally.
+    */
+    virtual const SelectFilter *select() const { return nullptr; }
+    /**
+     * @brief Keeps the value and everything below it, like Identity.
+    */
+    virtual bool keepsAll() const { return false; }
 
   protected:
   private:
   };
 
+  /**
+   * @brief Keeps the value and everything below it.
+  */
   class Identity : public Filter {
   public:
     const Filter *keep(const Value &) const override;
+    const Filter *keepKey(std::string_view) const override { return this; }
+    const Filter *keepIdx(int) const override { return this; }
+    bool keepsAll() const override { return true; }
   protected:
   private:
   };
@@ -43,30 +225,106 @@ namespace FilteredJSON
     Collector(std::unique_ptr<Filter> && filter) : m_filter{ std::move(filter) } {}
     const Filter *keep(const Value &value) const override;
     const Filter *keepIdx(int idx) const override { return m_filter.get(); }
+    int keyLimit() const override { return 0; }
     const Filter &filter() const;
   protected:
   private:
     std::unique_ptr<Filter> m_filter;
   };
 
+  /**
+   * @brief Operates on an object, keeping only the listed keys.
+   * Each kept key has its own filter applied to its value.
+  */
   class ObjectFilter final : public Filter {
   public:
-    bool containsKey(const std::string &s) const;
-    const Filter &at(const std::string &s) const;
-    const Filter *keepKey(const std::string &key) const override;
+    ObjectFilter &add(const std::string &key, std::unique_ptr<Filter> &&filter);
+    bool containsKey(std::string_view s) const;
+    const Filter &at(std::string_view s) const;
+    const Filter *keep(const Value &value) const override;
+    const Filter *keepKey(std::string_view key) const override;
+    int keyLimit() const override { return int(m_key_filters.size()); }
+    int indexLimit() const override { return 0; }
+    const KeyPrefilter *keyPrefilter() const override { return &m_prefilter; }
   protected:
   private:
-    std::unordered_map<std::string, std::unique_ptr<Filter>> m_key_filters;
+    // hashes std::string and std::string_view alike, so lookups don't allocate
+    struct KeyHash {
+      using is_transparent = void;
+      size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+    // a kept key with its first 16 bytes as words, compared two words at a time
+    struct KeyEntry {
+      uint64_t words[2];
+      std::string_view key;
+      const Filter *filter;
+    };
+    std::unordered_map<std::string, std::unique_ptr<Filter>, KeyHash, std::equal_to<>> m_key_filters;
+    // the matcher, extended by add()
+    // few keys are compared in turn, up to hashedKeys through a perfect hash
+    // of m_keys, and the map is only searched when there is no such hash
+    std::vector<KeyEntry> m_keys;
+    std::vector<int> m_slots;       //> entry of each perfect hash slot, -1 if empty
+    int m_seed = -1;
+    uint64_t m_lengths = 0;         //> bit per key length, lengths from 63 share the last
+    KeyPrefilter m_prefilter;
+
+    static constexpr size_t linearKeys = 4;
+    static constexpr size_t hashedKeys = 64;
+
+    void rehash();
+    static bool sameKey(const KeyEntry &entry, std::string_view key);
   };
 
+  /**
+   * @brief Operates on an array, keeping only the listed indices.
+   * Kept elements are compacted into the filtered array in index order.
+  */
   class ArrayFilter final : public Filter {
   public:
+    ArrayFilter &add(int idx, std::unique_ptr<Filter> &&filter);
+    /**
+     * @brief Sets the filter for every index without its own entry.
+    */
+    ArrayFilter &setOthers(std::unique_ptr<Filter> &&filter);
     bool containsIdx(int i) const;
     const Filter &at(int i) const;
     const Filter *keep(const Value &) const override;
     const Filter *keepIdx(int idx) const override;
+    int keyLimit() const override { return 0; }
+    int indexLimit() const override;
   protected:
   private:
     std::unordered_map<int, std::unique_ptr<Filter>> m_idx_filters;
+    std::unique_ptr<Filter> m_others;
+  };
+
+  /**
+   * @brief Keeps a value only if all of its predicates hold, filtered by
+   * filter(). The Parser holds back the events of each such value until the
+   * values its predicates look at have been read, then passes them on, or
+   * drops them and skips the rest of the value.
+   * Its keepKey()/keepIdx() keep what filter() keeps and the predicates'
+   * paths, which filter() may discard.
+  */
+  class SelectFilter final : public Filter {
+  public:
+    static constexpr size_t maxPredicates = 64;
+    SelectFilter(std::vector<Predicate> &&predicates, std::unique_ptr<Filter> &&filter, std::unique_ptr<Filter> &&scan)
+      : m_predicates{ std::move(predicates) }, m_filter{ std::move(filter) }, m_scan{ std::move(scan) } {}
+    const Filter *keep(const Value &value) const override { return m_filter->keep(value) ? this : nullptr; }
+    const Filter *keepKey(std::string_view key) const override { return m_scan->keepKey(key); }
+    const Filter *keepIdx(int idx) const override { return m_scan->keepIdx(idx); }
+    int keyLimit() const override { return m_scan->keyLimit(); }
+    int indexLimit() const override { return m_scan->indexLimit(); }
+    const KeyPrefilter *keyPrefilter() const override { return m_scan->keyPrefilter(); }
+    const SelectFilter *select() const override { return this; }
+    const std::vector<Predicate> &predicates() const { return m_predicates; }
+    const Filter &filter() const { return *m_filter; }
+  protected:
+  private:
+    std::vector<Predicate> m_predicates;
+    std::unique_ptr<Filter> m_filter;
+    std::unique_ptr<Filter> m_scan;   //> m_filter merged with the predicates' paths
   };
 } // namespace FilteredJSON
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "json.hpp"
+#include "document.hpp"
+#include "filter.hpp"
+#include "writer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Receives the parse as a stream of events instead of a Value tree.
+     * The Parser calls these in document order for every value its Filter
+     * keeps, skipped values raise no events at all. Events arrive while
+     * parseContinue() runs, so a value split across chunks is reported once,
+     * when its last chunk is parsed.
+     * Strings and keys are only valid during the call when copy is true, when
+     * false they point into the buffer handed to Parser::parseAll() and stay
+     * valid as long as it does.
+    */
+    class Handler{
+    public:
+        virtual ~Handler() = default;
+        virtual void onObjectStart() {}
+        virtual void onKey(std::string_view key, bool copy) {}
+        virtual void onObjectEnd() {}
+        virtual void onArrayStart() {}
+        virtual void onArrayEnd() {}
+        virtual void onString(std::string_view value, bool copy) {}
+        virtual void onNumber(Number value) {}
+        virtual void onBoolean(bool value) {}
+        virtual void onNull() {}
+        /**
+         * @brief The root value is complete, unless a select() dropped it.
+        */
+        virtual void onDocumentEnd() {}
+    };
+
+    /**
+     * @brief Handler building the events into a Document's Value tree.
+     * This is what a Parser without a Handler of its own uses.
+    */
+    class DomBuilder final : public Handler{
+    public:
+        DomBuilder(Document &document) : m_document{document}, m_root{&document.root()} {}
+        /**
+         * @brief Clears the Document and starts a new root value.
+        */
+        void reset();
+        /**
+         * @brief Builds the next value into root instead of the Document's root.
+         * root must be allocated from the Document, or not hold any value.
+        */
+        void setRoot(Value &root);
+        void onObjectStart() override;
+        void onKey(std::string_view key, bool copy) override;
+        void onObjectEnd() override;
+        void onArrayStart() override;
+        void onArrayEnd() override;
+        void onString(std::string_view value, bool copy) override;
+        void onNumber(Number value) override;
+        void onBoolean(bool value) override;
+        void onNull() override;
+    private:
+        Document &m_document;
+        Value *m_root;
+        std::vector<Value*> m_open;     //> objects and arrays not yet ended
+        Value *m_member = nullptr;      //> value of the last key, set by onKey
+
+        Value &next();
+    };
+
+    /**
+     * @brief Handler writing the events to a Writer as compact JSON, each
+     * root followed by a newline.
+     * A value may also be written as text of its own with beginRaw(),
+     * raw() and endRaw(), which is how the Parser's passthrough mode copies
+     * values from the input.
+    */
+    class Serializer final : public Handler{
+    public:
+        Serializer(Writer *out = nullptr) : m_out{out} {}
+        void setWriter(Writer *out) { m_out = out; reset(); }
+        /**
+         * @brief Forgets a value left half written, the next one is a new root.
+        */
+        void reset() { m_separate = false; }
+        /**
+         * @brief Starts a value whose JSON text is written by raw(),
+         * in as many pieces as it comes in.
+        */
+        void beginRaw() { separate(); }
+        void raw(std::string_view text) { m_out->write(text); }
+        void endRaw() { m_separate = true; }
+        void onObjectStart() override;
+        void onKey(std::string_view key, bool copy) override;
+        void onObjectEnd() override;
+        void onArrayStart() override;
+        void onArrayEnd() override;
+        void onString(std::string_view value, bool copy) override;
+        void onNumber(Number value) override;
+        void onBoolean(bool value) override;
+        void onNull() override;
+        void onDocumentEnd() override;
+    private:
+        Writer *m_out;
+        bool m_separate = false;    //> a ',' goes before the next key or value
+
+        void separate() { if(m_separate) m_out->put(','); }
+    };
+
+    /**
+     * @brief Handler holding back the events of a value a SelectFilter
+     * selects until its predicates are decided.
+     * Gets the events the SelectFilter's keepKey()/keepIdx() keep and passes
+     * on to output only what SelectFilter::filter() keeps: the events so far
+     * as soon as every predicate holds and the rest as they come, or none
+     * once one fails. Predicates whose path never turns up are tested as
+     * null by end(). The Parser sends a selected value's events here.
+    */
+    class Selection final : public Handler{
+    public:
+        /**
+         * @brief Starts on the next value, whose key may come first.
+        */
+        void begin(const SelectFilter &filter, Handler &output);
+        /**
+         * @brief The value is complete, or ended early.
+         * @return whether the value was kept
+        */
+        bool end();
+        /**
+         * @brief A predicate failed, the rest of the value can be skipped.
+        */
+        bool rejected() const { return m_failed; }
+        Handler &output() const { return *m_output; }
+        void onObjectStart() override;
+        void onKey(std::string_view key, bool copy) override;
+        void onObjectEnd() override;
+        void onArrayStart() override;
+        void onArrayEnd() override;
+        void onString(std::string_view value, bool copy) override;
+        void onNumber(Number value) override;
+        void onBoolean(bool value) override;
+        void onNull() override;
+    private:
+        enum class Kind : uint8_t{ ObjectStart, Key, ObjectEnd, ArrayStart, ArrayEnd, String, Number, Boolean, Null };
+        struct Event{
+            Kind kind;
+            bool boolean = false;
+            Number number{};
+            const char *data = nullptr; //> viewed text, nullptr if copied to m_text at offset
+            size_t offset = 0;
+            size_t size = 0;
+        };
+        // an open object or array of the value
+        struct Level{
+            const Filter *filter;   //> nullptr if not kept
+            uint64_t candidates;    //> predicates whose path may lead into it
+            bool array;
+            int index;
+        };
+        const SelectFilter *m_select = nullptr;
+        Handler *m_output = nullptr;
+        std::vector<Level> m_open;
+        const Filter *m_keyFilter = nullptr;    //> of the value after the last key
+        uint64_t m_keyCandidates = 0;
+        uint64_t m_all = 0;                     //> bit per predicate
+        uint64_t m_decided = 0;
+        bool m_failed = false;
+        bool m_passed = false;                  //> every predicate held, events go straight out
+        std::vector<Event> m_events;            //> held back until decided
+        std::string m_text;                     //> copied strings of m_events
+
+        const Filter *beginValue(uint64_t &candidates);
+        template<typename Test>
+        void decide(uint64_t candidates, Test test);
+        void emit(Event event, std::string_view text = {}, bool copy = false);
+        void flush();
+        void send(const Event &event, std::string_view text, bool copy);
+    };
+} // namespace FilteredJSON
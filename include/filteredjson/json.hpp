@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include <map>
@@ -8,7 +10,7 @@
 
 namespace FilteredJSON
 {
-    enum class Type{
+    enum class Type : uint8_t{
         String,
         Number,
         Object,
@@ -23,55 +25,136 @@ namespace FilteredJSON
     class Array;
     class Boolean;
     class Null;
+    class Document;
+    class Writer;
 
-    class Object final : public std::map<std::string, Value>{
+    /**
+     * @brief Allocator used by Object, Array and String.
+     * Defaults to the global heap, a Document hands out one backed by its arena.
+    */
+    using Allocator = std::pmr::polymorphic_allocator<>;
+
+    /**
+     * @brief A JSON string, either owning its chars or viewing someone else's.
+     * Owned chars come from the string's allocator, views are made by
+     * String::view() and only valid while the viewed buffer is.
+     * Copies always own their chars, moves keep a view a view.
+    */
+    class String final{
+    public:
+        using allocator_type = Allocator;
+        String() {}
+        explicit String(const Allocator &alloc) : m_alloc{alloc} {}
+        String(const String &s);
+        String(const String &s, const Allocator &alloc);
+        String(String &&s) noexcept;
+        String(String &&s, const Allocator &alloc);
+        String(std::string &&s);
+        String(std::string_view s, const Allocator &alloc = {});
+        ~String();
+        static String view(std::string_view s, const Allocator &alloc = {});
+        allocator_type get_allocator() const { return m_alloc; }
+        bool isView() const { return !m_owned && m_size; }
+        std::string_view getValue() const { return {m_data, m_size}; }
+        void setValue(std::string_view);
+        String& operator=(const String &s);
+        String& operator=(String &&s);
+        std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
+        operator std::string_view() const { return getValue(); }
+        friend bool operator==(const String &a, const String &b) { return a.getValue() == b.getValue(); }
+        friend auto operator<=>(const String &a, const String &b) { return a.getValue() <=> b.getValue(); }
+        friend bool operator==(const String &a, std::string_view b) { return a.getValue() == b; }
+        friend auto operator<=>(const String &a, std::string_view b) { return a.getValue() <=> b; }
+    private:
+        Allocator m_alloc;
+        const char *m_data = nullptr;
+        size_t m_size = 0;
+        bool m_owned = false;
+
+        void release();
+        void steal(String &s);
+    };
+
+    /**
+     * @brief A JSON object, members kept in insertion order in one vector.
+     * Lookups scan small objects linearly, an object reaching indexThreshold
+     * members builds a hash index of member positions as it is added to, so
+     * const lookups don't modify it and may run on many threads at once.
+     * Like the members of an Array, references to members are invalidated
+     * when a member is added. Keys must not be changed through iteration.
+    */
+    class Object final{
     public:
-        using Super = std::map<std::string, Value>;
+        using allocator_type = Allocator;
+        using Member = std::pair<String, Value>;
+        using iterator = std::pmr::vector<Member>::iterator;
+        using const_iterator = std::pmr::vector<Member>::const_iterator;
+        static constexpr size_t indexThreshold = 16;
+
         Object(){}
+        explicit Object(const Allocator &alloc);
         ~Object();
         Object(const Object &o);
+        Object(const Object &o, const Allocator &alloc);
         Object(Object &&o);
+        Object(Object &&o, const Allocator &alloc);
+        allocator_type get_allocator() const { return m_members.get_allocator(); }
+        size_t size() const;
+        bool empty() const;
+        iterator begin();
+        iterator end();
+        const_iterator begin() const;
+        const_iterator end() const;
+        iterator find(std::string_view);
+        const_iterator find(std::string_view) const;
+        bool contains(std::string_view k) const { return lookup(k) != nullptr; }
         Value &operator[](std::string_view);
         const Value &operator[](std::string_view) const;
+        /**
+         * @brief Value of key, inserted as null if missing.
+         * Unlike operator[] the key is moved in, so a String::view() key stays a view.
+        */
+        Value &add(String &&key);
         Object &operator=(const Object &o);
         Object &operator=(Object &&o);
         std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
     private:
-        // std::map<std::string, Value> m_values;
+        std::pmr::vector<Member> m_members;
+        //open addressing table of member position + 1, 0 if empty
+        //built by add() once the object is large
+        std::pmr::vector<uint32_t> m_index;
+
+        const Member *lookup(std::string_view k) const;
+        void buildIndex();
+        void indexMember(size_t pos);
     };
 
     class Array final{
     public:
+        using allocator_type = Allocator;
         Array(){}
+        explicit Array(const Allocator &alloc) : m_values{alloc} {}
         ~Array();
         Array(const Array &a);
+        Array(const Array &a, const Allocator &alloc);
         Array(Array &&a);
+        Array(Array &&a, const Allocator &alloc);
+        allocator_type get_allocator() const { return m_values.get_allocator(); }
+        size_t size() const { return m_values.size(); }
+        void reserve(size_t n) { m_values.reserve(n); }
         Value &operator[](int i);
         const Value &operator[](int i) const;
         Array &operator=(const Array &a);
         Array &operator=(Array &&a);
         Value& append(const Value &v);
+        Value& append(Value &&v);
         Value& append();
         std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
     private:
-        std::vector<Value> m_values;
-    };
-
-    class String final{
-    public:
-        String() {}
-        String(const String &s) : m_value{s.m_value}{}
-        String(String &&s) : m_value{std::move(s.m_value)}{}
-        String(std::string &&s) : m_value{std::move(s)}{}
-        String(std::string_view s) : m_value{s}{}
-        std::string_view getValue() const { return m_value; }
-        void setValue(std::string_view);
-        String& operator=(const String &s) { m_value = s.m_value; return *this; }
-        String& operator=(String &&s) { m_value = std::move(s.m_value); return *this; }
-        std::string stringify(int indent) const;
-        operator std::string_view() const { return m_value; }
-    private:
-        std::string m_value;
+        std::pmr::vector<Value> m_values;
     };
 
     class Number final{
@@ -87,6 +170,7 @@ namespace FilteredJSON
         IntType asInteger() const;
         FloatType asDouble() const;
         std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
     private:
         bool m_intNotDouble;
         union{
@@ -105,12 +189,26 @@ namespace FilteredJSON
         Boolean& operator=(bool);
         Boolean& operator=(const Boolean &b);
         std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
     private:
         bool m_value;
     };
 
+    /**
+     * @brief A JSON value, a 16 byte tagged union.
+     * Numbers and booleans are stored inline, strings, objects and arrays
+     * are owned through a pointer to their own allocation, made with the
+     * allocator of their contents.
+     * Containers pass their allocator down, so values appended or added to
+     * a Document's tree land in its arena. Copy assignment keeps the
+     * allocator of the string, object or array it replaces; a null or scalar
+     * has none, so assign `Value{v, document.allocator()}` to it instead.
+     * Plain copies use the default resource.
+    */
     class Value{
     public:
+        using allocator_type = Allocator;
+
         bool isString() const { return m_type == Type::String; }
         bool isNumber() const { return m_type == Type::Number; }
         bool isObject() const { return m_type == Type::Object; }
@@ -119,15 +217,13 @@ namespace FilteredJSON
         bool isNull() const { return m_type == Type::Null; }
 
         String &toString();
-        Number &toNumber();
         Object &toObject();
         Array &toArray();
-        Boolean &toBoolean();
         const String &toString() const;
-        const Number &toNumber() const;
+        Number toNumber() const;
         const Object &toObject() const;
         const Array &toArray() const;
-        const Boolean &toBoolean() const;
+        Boolean toBoolean() const;
 
         Type getType() const { return m_type; }
 
@@ -137,27 +233,41 @@ namespace FilteredJSON
         Value(Array a);
         Value(Boolean b);
         Value();
+        explicit Value(const Allocator &alloc);
         Value(const Value &v);
-        Value(Value &&v);
+        Value(const Value &v, const Allocator &alloc);
+        Value(Value &&v) noexcept;
+        Value(Value &&v, const Allocator &alloc);
         ~Value();
         Value& operator=(const Value& v);
-        Value& operator=(Value&& v);
+        Value& operator=(Value&& v) noexcept;
         operator bool() const { return !isNull(); }
 
         std::string stringify(int indent) const;
+        void serialize(Writer &out, int indent = -1) const;
     protected:
         Value(Type t);
     private:
+        friend class Document;
+        union{
+            bool b;
+            Number::IntType i = 0;
+            Number::FloatType d;
+            String *s;
+            Object *o;
+            Array *a;
+        } u;
         Type m_type;
-        // union Values{
-            String s;
-            Number n;
-            Object o;
-            Array a;
-            Boolean b;
-        //     ~Values(){}
-        // } u;
+        bool m_integer = false;     //> Number holds u.i rather than u.d
         void nullify();
+        void copyFrom(const Value &v, const Allocator &alloc);
     };
     
+    inline size_t Object::size() const { return m_members.size(); }
+    inline bool Object::empty() const { return m_members.empty(); }
+    inline Object::iterator Object::begin() { return m_members.begin(); }
+    inline Object::iterator Object::end() { return m_members.end(); }
+    inline Object::const_iterator Object::begin() const { return m_members.begin(); }
+    inline Object::const_iterator Object::end() const { return m_members.end(); }
+
 } // namespace FilteredJSON
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "json.hpp"
+#include "document.hpp"
+#include "handler.hpp"
+#include "parser.hpp"
+#include "structural.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace FilteredJSON
+{
+    class LazyDocument;
+
+    /**
+     * @brief Handle to a value of a LazyDocument.
+     * Navigating with operator[] only walks the tape, get() parses the value
+     * into a Value the first time it is called. A handle for a missing key or
+     * index is empty, see exists().
+    */
+    class LazyValue{
+    public:
+        LazyValue() {}
+        bool exists() const { return m_document; }
+        Type getType() const;
+        /**
+         * @brief Members of an object or elements of an array, 0 for scalars.
+        */
+        size_t size() const;
+        LazyValue operator[](std::string_view key) const;
+        LazyValue operator[](size_t i) const;
+        /**
+         * @brief The value, parsed on first use and kept by the LazyDocument.
+        */
+        const Value &get() const;
+        /**
+         * @brief The JSON text of the value in the input.
+        */
+        std::string_view raw() const;
+    private:
+        friend class LazyDocument;
+        const LazyDocument *m_document = nullptr;
+        uint32_t m_entry = 0;
+
+        LazyValue(const LazyDocument *document, uint32_t entry) : m_document{document}, m_entry{entry} {}
+    };
+
+    /**
+     * @brief Document parsed into a tape of offsets, values are built on access.
+     * parse() runs the StructuralIndexer over the input and records one tape
+     * entry per value and per closing bracket, with the entry of its closing
+     * bracket for objects and arrays so unvisited values are skipped in one
+     * step. The structure, numbers, literals and string escapes are checked
+     * up front, so LazyValue::get() can't fail, but a value is only built
+     * when get() asks for it.
+     * Like Parser::parseAll(), strings may view the input, so it must outlive
+     * the document.
+    */
+    class LazyDocument{
+    public:
+        /**
+         * @brief Clears the document and records the tape of input.
+         * @return false if the input is not a single valid JSON value
+        */
+        bool parse(std::string_view input);
+        LazyValue root() const;
+        void clear();
+        size_t tapeSize() const { return m_tape.size(); }
+    private:
+        friend class LazyValue;
+        // a value, or a closing bracket
+        // link is the closing entry of objects and arrays, the closing quote
+        // of strings and the count of members or elements of closing brackets
+        struct Entry{
+            uint32_t offset;
+            uint32_t link;
+        };
+        std::string_view m_input;
+        std::vector<Entry> m_tape;
+        StructuralIndexer m_indexer;
+        //values parsed on access, in m_document
+        mutable Document m_document;
+        mutable DomBuilder m_builder{m_document};
+        mutable Parser m_parser{m_builder};
+        mutable std::unordered_map<uint32_t, Value> m_values;
+
+        uint32_t next(uint32_t entry) const;
+        std::string_view raw(uint32_t entry) const;
+        const Value &materialize(uint32_t entry) const;
+
+        //size of the windows the input is indexed in
+        static constexpr size_t indexWindow = 64 * 1024;
+    };
+} // namespace FilteredJSON
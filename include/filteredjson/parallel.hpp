@@ -0,0 +1,69 @@
+#pragma once
+
+#include "document.hpp"
+#include "filter.hpp"
+#include "writer.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Parses newline delimited JSON on a pool of worker threads.
+     * The input is cut into chunks of about chunkSize bytes, each extended to
+     * the end of its last line, and every worker parses whole chunks with a
+     * multi-document Parser of its own. Each chunk's kept records are written
+     * compact, one per line, and handed on in input order through a window of
+     * chunks that may be parsed ahead of the output, which bounds the memory
+     * held by finished but not yet written chunks.
+     * Records must not contain raw newlines, which NDJSON guarantees.
+     * parseArray() splits a single document instead, one whose root is a
+     * huge array.
+    */
+    class ParallelParser{
+    public:
+        /**
+         * @param threads worker threads, 0 for one per hardware thread
+         * @param window chunks parsed ahead of the output, 0 for twice the threads
+        */
+        ParallelParser(const Filter *filter = nullptr, unsigned threads = 0,
+            size_t chunkSize = 1024 * 1024, size_t window = 0);
+        /**
+         * @brief Parses every record of input and writes the kept values to out.
+         * Only the calling thread writes to out.
+         * @return false if any chunk failed to parse
+        */
+        bool parse(std::string_view input, Writer &out);
+        /**
+         * @brief Parses a document whose root is an array into document.root(),
+         * splitting the elements between the threads.
+         * The input is cut into one range per thread, and each range is
+         * scanned for quotes and brackets twice, assuming it starts outside
+         * and inside a string. Chaining the ranges' end states then gives the
+         * true state at each range start. A second scan from that state finds
+         * the first top level ',' of every range. Each run of elements between
+         * those commas is parsed into a sub-document of document, and the
+         * elements are moved in order into the root array.
+         * Inputs of another shape, smaller than chunkSize per thread, or
+         * whose filter keeps no element or select()s the root, are parsed
+         * sequentially. Like Parser::parseAll(), strings may view the
+         * input, so it must outlive the document.
+         * @return false if the input failed to parse
+        */
+        bool parseArray(std::string_view input, Document &document);
+        unsigned threads() const { return m_threads; }
+    private:
+        // output of one chunk, ready once a worker has filled it
+        struct Slot{
+            std::string text;
+            bool ready = false;
+            bool valid = false;
+        };
+        const Filter *m_filter;
+        unsigned m_threads;
+        size_t m_chunkSize;
+        size_t m_window;
+    };
+} // namespace FilteredJSON
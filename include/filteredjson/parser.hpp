@@ -1,22 +1,156 @@
 #pragma once
 
 #include "json.hpp"
+#include "document.hpp"
+#include "file.hpp"
+#include "filter.hpp"
+#include "handler.hpp"
+#include "structural.hpp"
+#include "writer.hpp"
 
+#include <array>
+#include <functional>
+#include <memory>
 #include <string_view>
 #include <stack>
 
+// build options, see CMakeLists.txt
+#ifndef FILTEREDJSON_STATS
+#define FILTEREDJSON_STATS 0    //> collect Parser::stats()
+#endif
+#ifndef FILTEREDJSON_TRACE
+#define FILTEREDJSON_TRACE 0    //> print the parser's states as it goes
+#endif
+
 namespace FilteredJSON
 {
     class Parser{
     public:
+        /**
+         * @brief Result of parseContinue().
+        */
+        struct Status{
+            bool done;          //> the filter can keep nothing more, stop reading
+            size_t consumed;    //> bytes of the chunk parsed, all of them unless done
+        };
+        static constexpr size_t stateCount = 20;
+        /**
+         * @brief Counters of the parser's work since construction or clearStats().
+         * Only collected when built with FILTEREDJSON_STATS, otherwise the
+         * counting compiles to nothing and they all stay 0.
+        */
+        struct Stats{
+            size_t chunks = 0;          //> parseContinue() calls
+            size_t bytes = 0;           //> bytes parsed
+            size_t keptBytes = 0;       //> of which outside discarded values
+            size_t skippedBytes = 0;    //> of which inside discarded values, or copied by setPassthrough()
+            size_t values = 0;          //> values reported to the handler
+            size_t allocations = 0;     //> heap blocks taken by the parser's Document
+            size_t maxDepth = 0;        //> deepest nesting of objects and arrays
+            std::array<size_t, stateCount> stateBytes{}; //> bytes parsed in each state, see stateName()
+        };
+        static constexpr bool statsEnabled = FILTEREDJSON_STATS;
+        /**
+         * @brief Deepest nesting of kept objects and arrays, deeper input fails
+         * the parse. Discarded values are skipped at any depth.
+        */
+        static constexpr size_t maxDepth = 1024;
         Parser();
+        Parser(const Filter &filter);
+        /**
+         * @brief Parser reporting the parse to handler instead of building a tree.
+        */
+        Parser(Handler &handler);
+        Parser(Handler &handler, const Filter &filter);
         bool isValid() const;
+        /**
+         * @brief The filter can keep nothing further from the document.
+         * The root value is complete and the rest of the input is not read,
+         * so it is not checked either.
+        */
+        bool isDone() const { return currentState() == State::Done; }
+        /**
+         * @brief The parsed value, allocated in the parser's Document.
+         * Valid until the next reset(), copy it to keep it longer.
+         * Only built when the parser has no Handler set.
+        */
         Value &getValue();
+        Document &getDocument() { return document; }
+        Stats stats() const;
+        void clearStats();
+        static const char *stateName(size_t state) { return state_strs[state]; }
         void reset();
-        void parseContinue(std::string_view data);
+        void setFilter(const Filter *filter);
+        /**
+         * @brief Sends the events of the parse to handler, nullptr builds the
+         * Value tree again. Resets the parser.
+        */
+        void setHandler(Handler *handler);
+        /**
+         * @brief Passthrough mode: writes what the filter keeps to out as JSON
+         * instead of reporting it, each root followed by a newline.
+         * Strings, numbers and values the filter keeps whole are copied byte
+         * for byte from the input, even when split across chunks, without
+         * building anything. Like skipped values they are only scanned for
+         * brackets and quotes, not checked. Only the objects and arrays
+         * around them are written anew, compact, with their keys re-escaped
+         * as needed. Values under a select() are written from their events.
+         * nullptr builds the Value tree again. Resets the parser.
+        */
+        void setPassthrough(Writer *out);
+        /**
+         * @brief Multi-document mode: parses concatenated or newline delimited
+         * root values, starting over after each one instead of stopping.
+         * Every completed root raises Handler::onDocumentEnd(), without a
+         * Handler the built root is passed to callback and cleared once it
+         * returns. The Document and parse buffers are reused for each record.
+         * Resets the parser.
+        */
+        void setMultiDocument(bool enable, std::function<void(Value &root)> callback = {});
+        /**
+         * @brief Enables the StructuralIndexer first stage.
+         * Each chunk is indexed before the state machine runs over it, letting
+         * whitespace, strings and skipped values jump between structurals.
+         * Resets the parser.
+        */
+        void useStructuralIndex(bool enable, StructuralIndexer::Kernel kernel = StructuralIndexer::Kernel::Auto);
+        /**
+         * @brief Parses the next chunk of the input, resuming wherever the
+         * last chunk ended.
+         * Objects and arrays are ended early once the filter's keyLimit() or
+         * indexLimit() says nothing more of them can be kept, and their rest
+         * is skipped. When that ends the root the parse is done, the rest of
+         * the chunk is left unread and later chunks are ignored. In
+         * multi-document mode only the rest of the record is skipped.
+        */
+        Status parseContinue(std::string_view data);
+        /**
+         * @brief Resets and parses a complete document held in one buffer.
+         * The buffer must outlive the parsed value: strings and keys without
+         * escapes are String::view()s into it, only escaped ones are copied
+         * into the Document.
+         * @return isValid()
+        */
+        bool parseAll(std::string_view input);
+        /**
+         * @brief Resets and parses the file at path.
+         * Regular files are memory mapped and parsed in place like parseAll(),
+         * the mapping is kept until the next parseFile() as strings may view
+         * it. Pipes and other unmappable inputs are read in blocks of
+         * readBlockSize and parsed with parseContinue().
+         * @return isValid(), false if path can't be read
+        */
+        bool parseFile(const std::string &path);
+        /**
+         * @brief Signals the end of the input.
+         * A root scalar has no closing character, so a bare number or literal
+         * only completes once finish() tells the parser nothing follows it.
+        */
+        void finish();
     protected:
     private:
-        enum class State{
+        friend class ParallelParser;
+        enum class State : uint8_t{
             Start,
             ObjectOpen,     //> '{' found, eat WS until '"' or '}
             ObjectKey,      //> '"' found, parse string until '"' and eat WS
@@ -27,25 +161,126 @@ namespace FilteredJSON
             ArrayValue,     //> Parsing value. once complete read ',' or ']'
             ArrayComma,     //> Read ',', parse value after WS
             String,         //> '"' found, parse until '"' and eat WS
-            Number,         //> Reading Int/Float number into token
+            StringEscape,   //> '\\' found in String, read the escaped char
+            StringUnicode,  //> "\\u" found in String, read 4 hex digits
+            Number,         //> Reading Int/Float number, see NumberPart
             TrueStart,      //> Reading "true" into token
             FalseStart,     //> Reading "false" into token
             NullStart,      //> Reading "null"
+            Skip,           //> Discarded value, balance brackets/quotes until it ends
             Error,          //> Error in parsing
             Stop,           //> Root value parsed, only whitespace left
+            Done,           //> Root ended early by the filter, input is ignored
+        };
+        //position inside the JSON number grammar, one step per char
+        enum class NumberPart : uint8_t{
+            Start,      //> nothing read yet
+            Sign,       //> '-'
+            Zero,       //> leading '0', only '.', 'e' or the end may follow
+            Int,        //> integer digits
+            Dot,        //> '.', a digit must follow
+            Frac,       //> fraction digits
+            Exp,        //> 'e' or 'E'
+            ExpSign,    //> '+' or '-' after the exponent marker
+            ExpInt,     //> exponent digits
         };
-        std::vector<State> state;
-        std::vector<Value*> branch;
+        //stack kept inline in the parser, sized by maxDepth
+        template<typename T, size_t N>
+        class FixedStack{
+        public:
+            void push_back(T v) { m_items[m_size++] = v; }
+            void pop_back() { m_size--; }
+            T &back() { return m_items[m_size - 1]; }
+            T back() const { return m_items[m_size - 1]; }
+            size_t size() const { return m_size; }
+            void clear() { m_size = 0; }
+            const T *begin() const { return m_items; }
+            const T *end() const { return m_items + m_size; }
+        private:
+            T m_items[N];
+            size_t m_size = 0;
+        };
+        //each open container holds one state, the innermost value a few more
+        //the branch stacks hold at most one entry per open container and the root
+        FixedStack<State, maxDepth + 8> state;
+        FixedStack<const Filter*, maxDepth + 8> filters; //> filter of each open value, nullptr if discarded
+        FixedStack<int, maxDepth + 8> arrayIndex;        //> next element index of each open array
+        FixedStack<int, maxDepth + 8> limits;            //> keys left or index limit of each open container, -1 if none
+        const Filter *rootFilter = nullptr;
+        int skipDepth = 0;
+        bool skipInString = false;
+        bool skipEscape = false;
+        NumberPart numberPart = NumberPart::Start;
+        int unicodeDigits = 0;              //> hex digits read of the current \\u escape
+        unsigned unicodeValue = 0;
+        unsigned highSurrogate = 0;         //> pending UTF-16 high surrogate, 0 if none
+        bool borrowing = false;             //> strings may view the input, see parseAll()
+        const char *stringStart = nullptr;  //> first char of the current string in the input
+        bool stringCopied = false;          //> current string is built in token, not viewed
+        std::string_view stringValue;       //> last complete string, in token or the input
+        const KeyPrefilter *keyPrefilter = nullptr; //> of the key being read, nullptr once it can't help
+        size_t keyLength = 0;               //> bytes of the key read so far
+        bool keyRejected = false;           //> the key being read is discarded, its text isn't gathered
+        bool indexing = false;
+        StructuralIndexer indexer;
+        const char *windowBegin = nullptr;  //> indexed window being parsed
+        const char *windowEnd = nullptr;
+        const uint32_t *structural = nullptr; //> next unvisited index entry of the window
+        const uint32_t *structuralEnd = nullptr;
+
+        //size of the windows a chunk is indexed in, keeps the index cache resident
+        static constexpr size_t indexWindow = 64 * 1024;
+        static constexpr size_t readBlockSize = 1024 * 1024;
+        MappedFile file;                    //> input of the last parseFile()
         bool error = false;
-        Value rootValue;
+        bool multiDocument = false;
+        std::function<void(Value&)> documentCallback;
+        Document document;
+        DomBuilder builder{document};
+        Handler *handler = &builder;
+        Serializer serializer;              //> handler of passthrough mode
+        bool passthrough = false;
+        bool skipCopy = false;              //> the skipped value is passed through, see copySkipped()
         std::string token;
+        //selected values whose events are held back, innermost last
+        struct OpenSelection{
+            std::unique_ptr<Selection> selection;
+            size_t depth;                   //> containers open around the value
+        };
+        std::vector<OpenSelection> selections; //> reused, the first `selecting` are open
+        size_t selecting = 0;
+        bool rootDropped = false;           //> a select() dropped the last root
+
+        Stats counters;
+        size_t countedAllocations = 0;      //> document.allocations() at clearStats()
 
-        State popState() { State s = state.back(); state.pop_back(); printStateStack(); return s; }
-        void pushState(State s) { state.push_back(s); printStateStack(); }
+        State popState() {
+            State s = state.back();
+            state.pop_back();
+#if FILTEREDJSON_TRACE
+            printStateStack();
+#endif
+            return s;
+        }
+        void pushState(State s) {
+            state.push_back(s);
+#if FILTEREDJSON_TRACE
+            printStateStack();
+#endif
+        }
 
         State currentState() const { return state.back(); }
-        Value &currentValue() const { return *branch.back(); }
+        //replace the current state, like a popState() and pushState() pair
+        void setState(State s) {
+            state.back() = s;
+#if FILTEREDJSON_TRACE
+            printStateStack();
+#endif
+        }
+        const Filter *currentFilter() const { return filters.back(); }
         void fail();
+        size_t parseWindow(std::string_view data);
+        const char *nextStructural(const char *p);
         void consumeWhitespace(std::string_view &data);
         bool consumeChar(std::string_view &data, char c);
         char consumeChar(std::string_view &data);
@@ -59,12 +294,32 @@ namespace FilteredJSON
         void parseArrayOpen(std::string_view &data);
         void parseArrayValue(std::string_view &data);
         void parseArrayComma(std::string_view &data);
+        void beginArrayElement(std::string_view &data);
+        void beginSkip();
+        void parseSkip(std::string_view &data);
+        void copySkipped(const char *begin, const char *end);
+        bool copyRaw() const { return passthrough && !selecting; }
+        void beginString(std::string_view &data);
+        void beginKey(std::string_view &data);
         void parseString(std::string_view &data);
+        void parseStringEscape(std::string_view &data);
+        void parseStringUnicode(std::string_view &data);
+        void appendCodepoint(unsigned cp);
+        void flushSurrogate();
         bool tryParseValue(std::string_view &data);
+        void endValue();
+        void pushLimit(int limit);
+        bool exhausted() const;
+        void closeLevel();
+        void endContainer(size_t depth);
+        void beginSelection(const SelectFilter &filter);
+        bool endSelection();
         void parseNumber(std::string_view &data);
+        void endNumber(std::string_view text);
         void parseTrue(std::string_view &data);
         void parseFalse(std::string_view &data);
         void parseNull(std::string_view &data);
+        bool parseLiteral(std::string_view &data, std::string_view word);
 
         void printStateStack();
 
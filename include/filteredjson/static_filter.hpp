@@ -0,0 +1,327 @@
+#pragma once
+
+#include "filter.hpp"
+#include "json.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace FilteredJSON
+{
+  /**
+   * @brief String literal usable as a template argument.
+  */
+  template<size_t N>
+  struct fixed_string {
+    char value[N]{};
+    constexpr fixed_string(const char (&s)[N]) { std::copy_n(s, N, value); }
+    constexpr std::string_view view() const { return {value, N - 1}; }
+  };
+
+  namespace detail
+  {
+    // not constexpr, so a malformed path fails to compile where it's reached
+    void malformedStaticFilterPath();
+
+    // tree of the paths built at compile time
+    // paths through `[]` are replayed into the indices of the same array
+    // so `.a[].x, .a[1].y` keeps both x and y of element 1, like from_string()
+    struct StaticTree {
+      struct Node {
+        bool all = false;     //> keep the whole value
+        int others = -1;      //> node of `[]`
+      };
+      struct Edge {
+        int parent;
+        std::string_view key; //> for index < 0
+        int index;
+        int child;
+      };
+      struct Replay {
+        int node;
+        std::string_view rest;
+      };
+      std::vector<Node> nodes{Node{}};
+      std::vector<Edge> edges;
+      std::vector<Replay> replays;
+
+      constexpr StaticTree(std::initializer_list<std::string_view> paths) {
+        for (std::string_view path : paths) {
+          if (path.starts_with('.'))
+            path.remove_prefix(1);
+          insert(0, path);
+        }
+      }
+
+      // string_view::find() isn't a constant expression everywhere
+      static constexpr size_t find(std::string_view s, char c) {
+        size_t i = 0;
+        while (i < s.size() && s[i] != c)
+          i++;
+        return i;
+      }
+
+      constexpr int addNode() {
+        nodes.push_back({});
+        return int(nodes.size()) - 1;
+      }
+
+      constexpr void insert(int node, std::string_view path) {
+        if (path.empty()) {
+          nodes[node].all = true;
+          return;
+        }
+        std::string_view rest;
+        if (path.front() == '[') {
+          size_t close = find(path, ']');
+          if (close == path.size())
+            malformedStaticFilterPath();
+          std::string_view digits = path.substr(1, close - 1);
+          rest = next(path.substr(close + 1));
+          if (digits.empty()) {
+            // `[]`, also applies to the indices listed so far
+            replays.push_back({node, rest});
+            if (nodes[node].others < 0) {
+              int child = addNode();
+              nodes[node].others = child;
+            }
+            insert(nodes[node].others, rest);
+            for (size_t e = 0; e < edges.size(); e++)
+              if (edges[e].parent == node && edges[e].index >= 0)
+                insert(edges[e].child, rest);
+            return;
+          }
+          int index = 0;
+          for (char c : digits) {
+            if (c < '0' || c > '9')
+              malformedStaticFilterPath();
+            index = index * 10 + (c - '0');
+          }
+          insert(child(node, {}, index), rest);
+          return;
+        }
+        size_t end = std::min(find(path, '.'), find(path, '['));
+        std::string_view key = path.substr(0, end);
+        if (key.empty())
+          malformedStaticFilterPath();
+        rest = next(path.substr(key.size()));
+        insert(child(node, key, -1), rest);
+      }
+
+      // the rest of a path after a segment, without the '.' of a key
+      constexpr std::string_view next(std::string_view rest) {
+        if (rest.starts_with('.')) {
+          rest.remove_prefix(1);
+          if (rest.empty() || rest.front() == '.' || rest.front() == '[')
+            malformedStaticFilterPath();
+        }
+        return rest;
+      }
+
+      // the node of key (index < 0) or index below node, added if new
+      constexpr int child(int node, std::string_view key, int index) {
+        for (const Edge &e : edges)
+          if (e.parent == node && e.index == index && e.key == key)
+            return e.child;
+        int child = addNode();
+        edges.push_back({node, key, index, child});
+        if (index >= 0) {
+          // a new index gets what `[]` got so far
+          for (size_t r = 0; r < replays.size(); r++)
+            if (replays[r].node == node)
+              insert(child, replays[r].rest);
+        }
+        return child;
+      }
+
+      constexpr size_t slots() const {
+        size_t total = 0;
+        for (size_t n = 0; n < nodes.size(); n++)
+          total += perfectSlots(std::count_if(edges.begin(), edges.end(),
+                                          [&](const Edge &e) { return e.parent == int(n) && e.index < 0; }));
+        return total;
+      }
+    };
+
+    // the tree flattened into arrays, edges grouped by node and sorted
+    template<size_t Nodes, size_t Edges, size_t Slots>
+    struct StaticTable {
+      struct Node {
+        bool all = false;
+        int others = -1;
+        int firstKey = 0, keys = 0;
+        int firstIndex = 0, indices = 0;
+        int indexLimit = 0;
+        int seed = -1;        //> perfect hash seed of the keys, -1 to compare each
+        int firstSlot = 0, slots = 0;
+      };
+      std::array<Node, Nodes> nodes{};
+      std::array<std::string_view, Edges> keys{};
+      std::array<int, Edges> indices{};   //> of index edges, after the keys
+      std::array<int, Edges> children{};
+      std::array<int, Slots + 1> slots{}; //> key edge of each hash slot, -1 if empty
+      std::array<KeyPrefilter, Nodes> prefilters{};
+
+      constexpr StaticTable(const StaticTree &tree) {
+        std::vector<StaticTree::Edge> edges = tree.edges;
+        std::sort(edges.begin(), edges.end(), [](const StaticTree::Edge &a, const StaticTree::Edge &b) {
+          if (a.parent != b.parent)
+            return a.parent < b.parent;
+          if ((a.index < 0) != (b.index < 0))
+            return a.index < 0;
+          return a.index < 0 ? a.key < b.key : a.index < b.index;
+        });
+        for (size_t e = 0; e < edges.size(); e++) {
+          keys[e] = edges[e].key;
+          indices[e] = edges[e].index;
+          children[e] = edges[e].child;
+        }
+        size_t e = 0;
+        int slot = 0;
+        for (size_t n = 0; n < Nodes; n++) {
+          Node &node = nodes[n];
+          node.all = tree.nodes[n].all;
+          node.others = tree.nodes[n].others;
+          node.firstKey = int(e);
+          for (; e < edges.size() && edges[e].parent == int(n) && edges[e].index < 0; e++) {
+            node.keys++;
+            prefilters[n].add(edges[e].key);
+          }
+          node.firstIndex = int(e);
+          for (; e < edges.size() && edges[e].parent == int(n); e++) {
+            node.indices++;
+            node.indexLimit = edges[e].index + 1;
+          }
+          node.firstSlot = slot;
+          node.slots = int(perfectSlots(node.keys));
+          slot += node.slots;
+          std::string_view *first = keys.data() + node.firstKey;
+          node.seed = node.keys ? perfectSeed(std::vector<std::string_view>(first, first + node.keys), node.slots) : -1;
+          for (int s = 0; s < node.slots; s++)
+            slots[node.firstSlot + s] = -1;
+          if (node.seed >= 0)
+            for (int k = node.firstKey; k < node.firstKey + node.keys; k++)
+              slots[node.firstSlot + (keyHash(keys[k], node.seed) & (node.slots - 1))] = k;
+        }
+      }
+    };
+  } // namespace detail
+
+  /**
+   * @brief Filter of paths fixed at compile time, e.g.
+   * `StaticFilter<"items[].id", "meta.ts">`.
+   * Paths are keys separated by '.', `[n]` and `[]`, with an optional
+   * leading '.'; keys are matched verbatim, without quoting or escapes.
+   * Paths are merged into a tree of constant tables at compile time, each
+   * object's keys looked up through a perfect hash, see detail::keyHash(),
+   * and one compare, so a parsed key costs no allocation or map lookup.
+   * A malformed path fails to compile.
+  */
+  template<fixed_string... Paths>
+  class StaticFilter final : public Filter {
+    static constexpr auto tree() { return detail::StaticTree{Paths.view()...}; }
+    static constexpr size_t nodeCount = tree().nodes.size();
+    static constexpr size_t edgeCount = tree().edges.size();
+    static constexpr size_t slotCount = tree().slots();
+    using Table = detail::StaticTable<nodeCount, edgeCount, slotCount>;
+    static constexpr Table table{tree()};
+
+  public:
+    /**
+     * @brief The filter of one node of the tree, the root's is the StaticFilter.
+    */
+    class Node final : public Filter {
+    public:
+      constexpr Node() {}
+      constexpr Node(const Node *nodes, int node) : m_nodes{nodes}, m_node{node} {}
+
+      const Filter *keep(const Value &value) const override {
+        const auto &n = table.nodes[m_node];
+        if (n.all || (value.isObject() && n.keys) || (value.isArray() && (n.indices || n.others >= 0)))
+          return this;
+        return nullptr;
+      }
+
+      const Filter *keepKey(std::string_view key) const override {
+        const auto &n = table.nodes[m_node];
+        if (n.all)
+          return this;
+        if (n.seed >= 0) {
+          int k = table.slots[n.firstSlot + (detail::keyHash(key, n.seed) & (n.slots - 1))];
+          if (k >= 0 && table.keys[k] == key)
+            return m_nodes + table.children[k];
+          return nullptr;
+        }
+        for (int k = n.firstKey; k < n.firstKey + n.keys; k++)
+          if (table.keys[k] == key)
+            return m_nodes + table.children[k];
+        return nullptr;
+      }
+
+      const Filter *keepIdx(int idx) const override {
+        const auto &n = table.nodes[m_node];
+        if (n.all)
+          return this;
+        for (int i = n.firstIndex; i < n.firstIndex + n.indices; i++)
+          if (table.indices[i] == idx)
+            return m_nodes + table.children[i];
+        return n.others >= 0 ? m_nodes + n.others : nullptr;
+      }
+
+      int keyLimit() const override {
+        const auto &n = table.nodes[m_node];
+        return n.all ? -1 : n.keys;
+      }
+
+      int indexLimit() const override {
+        const auto &n = table.nodes[m_node];
+        return n.all || n.others >= 0 ? -1 : n.indexLimit;
+      }
+
+      const KeyPrefilter *keyPrefilter() const override {
+        return table.nodes[m_node].all ? nullptr : &table.prefilters[m_node];
+      }
+
+      bool keepsAll() const override { return table.nodes[m_node].all; }
+
+    private:
+      const Node *m_nodes = nullptr;
+      int m_node = 0;
+    };
+
+    constexpr StaticFilter() {
+      for (size_t n = 0; n < nodeCount; n++)
+        m_nodes[n] = Node{m_nodes.data(), int(n)};
+    }
+    StaticFilter(const StaticFilter &) = delete;
+    StaticFilter &operator=(const StaticFilter &) = delete;
+
+    const Filter *keep(const Value &value) const override {
+      const Filter *f = m_nodes[0].keep(value);
+      return f ? this : nullptr;
+    }
+    const Filter *keepKey(std::string_view key) const override { return redirect(m_nodes[0].keepKey(key)); }
+    const Filter *keepIdx(int idx) const override { return redirect(m_nodes[0].keepIdx(idx)); }
+    int keyLimit() const override { return m_nodes[0].keyLimit(); }
+    int indexLimit() const override { return m_nodes[0].indexLimit(); }
+    const KeyPrefilter *keyPrefilter() const override { return m_nodes[0].keyPrefilter(); }
+    bool keepsAll() const override { return m_nodes[0].keepsAll(); }
+
+  private:
+    std::array<Node, nodeCount> m_nodes;
+
+    // the root node stands for the whole filter
+    const Filter *redirect(const Filter *f) const { return f == &m_nodes[0] ? this : f; }
+  };
+
+  /**
+   * @brief A StaticFilter of Paths, e.g.
+   * `Parser parser{static_filter<"items[].id", "meta.ts">};`
+  */
+  template<fixed_string... Paths>
+  inline const StaticFilter<Paths...> static_filter{};
+} // namespace FilteredJSON
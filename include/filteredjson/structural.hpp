@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Optional first parsing stage, indexes the structure of a chunk.
+     * Quotes, backslashes, structural characters and whitespace are classified
+     * into bitmasks 64 bytes at a time (AVX2, SSE4.2 or scalar, picked at runtime).
+     * The index holds the offset of every '{' '}' '[' ']' ':' ',' outside strings,
+     * every unescaped '"' and the first byte of every other token, so anything
+     * between two entries outside a string is whitespace.
+     * Quote and escape state carries over to the next chunk.
+    */
+    class StructuralIndexer{
+    public:
+        enum class Kernel{
+            Auto,
+            Scalar,
+            SSE42,
+            AVX2,
+        };
+        struct Masks{
+            uint64_t quote;
+            uint64_t backslash;
+            uint64_t structural;
+            uint64_t whitespace;
+        };
+        using ClassifyFn = Masks (*)(const char *block);
+
+        StructuralIndexer(Kernel kernel = Kernel::Auto);
+        static bool isSupported(Kernel kernel);
+        Kernel getKernel() const { return m_kernel; }
+        void reset();
+        const std::vector<uint32_t> &index(std::string_view chunk);
+    private:
+        Kernel m_kernel;
+        ClassifyFn m_classify;
+        bool m_escapeCarry;     //> last byte of the previous chunk was an unescaped '\'
+        bool m_stringCarry;     //> previous chunk ended inside a string
+        bool m_scalarCarry;     //> previous chunk ended inside a bare token
+        std::vector<uint32_t> m_positions;
+
+        void indexBlock(const char *block, int len, uint32_t offset);
+    };
+} // namespace FilteredJSON
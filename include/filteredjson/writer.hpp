@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FilteredJSON
+{
+    /**
+     * @brief Destination of serialize(), appends into a buffer.
+     * Writes are plain copies into [m_pos, m_end); when that runs out
+     * overflow() makes room, by growing the buffer or handing it on.
+    */
+    class Writer{
+    public:
+        virtual ~Writer() = default;
+        void write(std::string_view s){
+            if(size_t(m_end - m_pos) < s.size())
+                return writeSlow(s);
+            memcpy(m_pos, s.data(), s.size());
+            m_pos += s.size();
+        }
+        void put(char c){
+            if(m_pos == m_end)
+                overflow(1);
+            *m_pos++ = c;
+        }
+        /**
+         * @brief Hands everything written so far on to the destination.
+        */
+        virtual void flush(){}
+    protected:
+        char *m_begin = nullptr;
+        char *m_pos = nullptr;
+        char *m_end = nullptr;
+        /**
+         * @brief Makes room for at least need more chars.
+        */
+        virtual void overflow(size_t need) = 0;
+    private:
+        void writeSlow(std::string_view s);
+    };
+
+    /**
+     * @brief Writes into a growable string.
+    */
+    class BufferWriter final : public Writer{
+    public:
+        BufferWriter(size_t reserve = 256);
+        std::string_view view() const { return {m_begin, size_t(m_pos - m_begin)}; }
+        size_t size() const { return m_pos - m_begin; }
+        void clear() { m_pos = m_begin; }
+        std::string take();
+    protected:
+        void overflow(size_t need) override;
+    private:
+        std::string m_out;
+    };
+
+    /**
+     * @brief Writes to a std::ostream in blocks of bufferSize.
+    */
+    class StreamWriter final : public Writer{
+    public:
+        StreamWriter(std::ostream &out, size_t bufferSize = 64 * 1024);
+        ~StreamWriter();
+        void flush() override;
+    protected:
+        void overflow(size_t need) override;
+    private:
+        std::ostream &m_out;
+        std::vector<char> m_buffer;
+    };
+
+    /**
+     * @brief Hands output to a callback in chunks of chunkSize,
+     * the last chunk is handed on by flush().
+    */
+    class CallbackWriter final : public Writer{
+    public:
+        using Callback = std::function<void(std::string_view)>;
+        CallbackWriter(Callback callback, size_t chunkSize = 64 * 1024);
+        ~CallbackWriter();
+        void flush() override;
+    protected:
+        void overflow(size_t need) override;
+    private:
+        Callback m_callback;
+        std::vector<char> m_buffer;
+    };
+} // namespace FilteredJSON
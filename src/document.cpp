@@ -0,0 +1,58 @@
+#include "filteredjson/document.hpp"
+
+using namespace FilteredJSON;
+
+void *Document::Upstream::do_allocate(size_t bytes, size_t alignment){
+    allocated += bytes;
+    blocks++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void Document::Upstream::do_deallocate(void *p, size_t bytes, size_t alignment){
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool Document::Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept{
+    auto *arena = dynamic_cast<const Arena*>(&other);
+    return arena && arena->m_group == m_group;
+}
+
+Document::Document(size_t initialSize) : Document{initialSize, nullptr} {}
+
+Document::Document(size_t initialSize, const Document *group)
+    : m_buffer{std::make_unique_for_overwrite<std::byte[]>(initialSize)}, m_bufferSize{initialSize} {
+    if(group)
+        m_group = group;
+    m_upstream.blocks++;
+    m_arena.emplace(m_buffer.get(), m_bufferSize, &m_upstream, m_group);
+}
+
+Document::~Document(){
+    forgetRoot();
+}
+
+void Document::forgetRoot(){
+    //everything below the root lives in the arena and is freed with it
+    //so drop the tree without running its destructors
+    m_root.m_type = Type::Null;
+}
+
+void Document::clear(){
+    forgetRoot();
+    m_subDocuments.clear();
+    m_arena->release();
+    if(m_upstream.allocated){
+        //last document outgrew the first buffer, grow it to fit next time
+        m_bufferSize += m_upstream.allocated;
+        m_upstream.allocated = 0;
+        m_arena.reset();
+        m_buffer = std::make_unique_for_overwrite<std::byte[]>(m_bufferSize);
+        m_upstream.blocks++;
+        m_arena.emplace(m_buffer.get(), m_bufferSize, &m_upstream, m_group);
+    }
+}
+
+Document &Document::subDocument(size_t initialSize){
+    m_subDocuments.emplace_back(new Document{initialSize, m_group});
+    return *m_subDocuments.back();
+}
@@ -0,0 +1,205 @@
+#include "filteredjson/fanout.hpp"
+
+using namespace FilteredJSON;
+
+void FanOut::add(const Filter *filter, Handler &handler){
+    m_consumers.push_back({filter ? filter : &m_keepAll, &handler, &handler, {}, {}});
+    m_roots.push_back({uint32_t(m_consumers.size() - 1), m_consumers.back().filter});
+    reset();
+}
+
+void FanOut::setMultiDocument(bool enable){
+    m_parser.setMultiDocument(enable);
+    reset();
+}
+
+void FanOut::reset(){
+    //events of a half parsed value would be meaningless to the consumers
+    m_parser.reset();
+    for(Consumer &c : m_consumers){
+        c.output = c.handler;
+        c.depths.clear();
+        c.dropped = false;
+    }
+    m_routes.clear();
+    m_levels.clear();
+    m_next.clear();
+    m_keyed = false;
+}
+
+Parser::Status FanOut::parseContinue(std::string_view data){
+    return m_parser.parseContinue(data);
+}
+
+bool FanOut::parseAll(std::string_view input){
+    reset();
+    return m_parser.parseAll(input);
+}
+
+bool FanOut::parseFile(const std::string &path){
+    reset();
+    return m_parser.parseFile(path);
+}
+
+void FanOut::finish(){
+    m_parser.finish();
+}
+
+const Filter *FanOut::keepKey(std::string_view key) const{
+    //the consumers keeping key of the innermost object, nullptr if none
+    m_next.clear();
+    const Route *end = m_routes.data() + m_routes.size();
+    for(const Route *r = m_routes.data() + m_levels.back().first; r != end; ++r)
+        if(const Filter *f = r->filter->keepKey(key))
+            m_next.push_back({r->consumer, f});
+    return m_next.empty() ? nullptr : this;
+}
+
+const Filter *FanOut::keepIdx(int idx) const{
+    m_next.clear();
+    const Route *end = m_routes.data() + m_routes.size();
+    for(const Route *r = m_routes.data() + m_levels.back().first; r != end; ++r)
+        if(const Filter *f = r->filter->keepIdx(idx))
+            m_next.push_back({r->consumer, f});
+    return m_next.empty() ? nullptr : this;
+}
+
+const KeyPrefilter *FanOut::keyPrefilter() const{
+    const Level &level = m_levels.back();
+    return level.prefiltered ? &level.prefilter : nullptr;
+}
+
+void FanOut::beginValue(){
+    //a value starts, the root is kept by every consumer
+    //selected values begin before their key, or here if they have none
+    if(m_levels.empty())
+        m_next = m_roots;
+    if(!m_keyed)
+        beginSelections();
+    m_keyed = false;
+}
+
+void FanOut::beginSelections(){
+    for(const Route &r : m_next){
+        const SelectFilter *select = r.filter->select();
+        if(!select)
+            continue;
+        Consumer &c = m_consumers[r.consumer];
+        if(c.depths.size() == c.selections.size())
+            c.selections.push_back(std::make_unique<Selection>());
+        Selection &selection = *c.selections[c.depths.size()];
+        selection.begin(*select, *c.output);
+        c.output = &selection;
+        c.depths.push_back(m_levels.size());
+    }
+}
+
+void FanOut::endSelections(const Route *begin, const Route *end){
+    //the value at the current level ended, decide the selections on it
+    for(const Route *r = begin; r != end; ++r){
+        Consumer &c = m_consumers[r->consumer];
+        if(c.depths.empty() || c.depths.back() != m_levels.size())
+            continue;
+        Selection &selection = *c.selections[c.depths.size() - 1];
+        c.output = &selection.output();
+        c.depths.pop_back();
+        bool kept = selection.end();
+        if(m_levels.empty())
+            c.dropped = !kept;
+    }
+}
+
+void FanOut::pushLevel(bool array){
+    //the consumers keeping the container are the routes of its values
+    //the parser's limits must hold for all of them at once
+    Level level{m_routes.size(), array, 0, 0, true, {}};
+    for(const Route &r : m_next){
+        int keys = r.filter->keyLimit();
+        level.keyLimit = keys < 0 || level.keyLimit < 0 ? -1 : level.keyLimit + keys;
+        int indices = r.filter->indexLimit();
+        level.indexLimit = indices < 0 || level.indexLimit < 0 ? -1 : std::max(level.indexLimit, indices);
+        if(const KeyPrefilter *prefilter = r.filter->keyPrefilter())
+            level.prefilter.add(*prefilter);
+        else
+            level.prefiltered = false;
+    }
+    m_routes.insert(m_routes.end(), m_next.begin(), m_next.end());
+    m_levels.push_back(level);
+}
+
+void FanOut::popLevel(){
+    size_t first = m_levels.back().first;
+    m_levels.pop_back();
+    endSelections(m_routes.data() + first, m_routes.data() + m_routes.size());
+    m_routes.resize(first);
+}
+
+void FanOut::onObjectStart(){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onObjectStart();
+    pushLevel(false);
+}
+
+void FanOut::onKey(std::string_view key, bool copy){
+    //m_next was set by keepKey()
+    beginSelections();
+    m_keyed = true;
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onKey(key, copy);
+}
+
+void FanOut::onObjectEnd(){
+    for(size_t i = m_levels.back().first; i < m_routes.size(); i++)
+        m_consumers[m_routes[i].consumer].output->onObjectEnd();
+    popLevel();
+}
+
+void FanOut::onArrayStart(){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onArrayStart();
+    pushLevel(true);
+}
+
+void FanOut::onArrayEnd(){
+    for(size_t i = m_levels.back().first; i < m_routes.size(); i++)
+        m_consumers[m_routes[i].consumer].output->onArrayEnd();
+    popLevel();
+}
+
+void FanOut::onString(std::string_view value, bool copy){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onString(value, copy);
+    endSelections(m_next.data(), m_next.data() + m_next.size());
+}
+
+void FanOut::onNumber(Number value){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onNumber(value);
+    endSelections(m_next.data(), m_next.data() + m_next.size());
+}
+
+void FanOut::onBoolean(bool value){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onBoolean(value);
+    endSelections(m_next.data(), m_next.data() + m_next.size());
+}
+
+void FanOut::onNull(){
+    beginValue();
+    for(const Route &r : m_next)
+        m_consumers[r.consumer].output->onNull();
+    endSelections(m_next.data(), m_next.data() + m_next.size());
+}
+
+void FanOut::onDocumentEnd(){
+    for(Consumer &c : m_consumers){
+        if(!c.dropped)
+            c.handler->onDocumentEnd();
+        c.dropped = false;
+    }
+}
@@ -0,0 +1,142 @@
+#include "filteredjson/file.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#define FILTEREDJSON_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+using namespace FilteredJSON;
+
+MappedFile::~MappedFile(){
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&f) noexcept{
+    *this = std::move(f);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&f) noexcept{
+    if(this == &f)
+        return *this;
+    close();
+    m_copy = std::move(f.m_copy);
+    m_data = f.m_mapped ? f.m_data : m_copy.data();
+    m_size = f.m_size;
+    m_open = std::exchange(f.m_open, false);
+    m_mapped = std::exchange(f.m_mapped, false);
+    f.m_data = nullptr;
+    f.m_size = 0;
+    return *this;
+}
+
+#ifdef FILTEREDJSON_MMAP
+bool MappedFile::open(const std::string &path){
+    close();
+    //opening a fifo would consume its writer, so check before opening
+    struct stat st;
+    if(::stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+        return false;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)){
+        ::close(fd);
+        return false;
+    }
+    m_size = st.st_size;
+    if(m_size){
+        void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){
+            ::close(fd);
+            m_size = 0;
+            return false;
+        }
+        //read ahead aggressively and drop pages behind, huge pages cut TLB misses
+        //all hints, the mapping works the same if the kernel ignores them
+        madvise(p, m_size, MADV_SEQUENTIAL);
+        madvise(p, m_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        madvise(p, m_size, MADV_HUGEPAGE);
+#endif
+        m_data = static_cast<const char*>(p);
+        m_mapped = true;
+    }
+    //the mapping holds its own reference to the file
+    ::close(fd);
+    m_open = true;
+    return true;
+}
+
+void MappedFile::close(){
+    if(m_mapped)
+        munmap(const_cast<char*>(m_data), m_size);
+    m_copy.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+    m_mapped = false;
+}
+
+bool FilteredJSON::readBlocks(const std::string &path, size_t blockSize, const std::function<void(std::string_view)> &callback){
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    std::unique_ptr<char[]> block{new char[blockSize]};
+    ssize_t n;
+    while((n = ::read(fd, block.get(), blockSize)) != 0){
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            ::close(fd);
+            return false;
+        }
+        callback({block.get(), size_t(n)});
+    }
+    ::close(fd);
+    return true;
+}
+#else
+bool MappedFile::open(const std::string &path){
+    //no mmap, read the whole file instead
+    close();
+    std::ifstream in{path, std::ios::binary};
+    if(!in)
+        return false;
+    m_copy.assign(std::istreambuf_iterator<char>{in}, {});
+    m_data = m_copy.data();
+    m_size = m_copy.size();
+    m_open = true;
+    return true;
+}
+
+void MappedFile::close(){
+    m_copy.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+bool FilteredJSON::readBlocks(const std::string &path, size_t blockSize, const std::function<void(std::string_view)> &callback){
+    std::FILE *f = std::fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+    std::unique_ptr<char[]> block{new char[blockSize]};
+    size_t n;
+    while((n = std::fread(block.get(), 1, blockSize, f)) != 0)
+        callback({block.get(), n});
+    bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+#endif
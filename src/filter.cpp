@@ -1,5 +1,10 @@
 #include "filteredjson/filter.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <map>
+
 using namespace FilteredJSON;
 
 const Filter *Identity::keep(const Value&) const {
@@ -13,4 +18,680 @@ const Filter *Collector::keep(const Value &value) const {
     return nullptr;
 }
 
-// const Filter *
\ No newline at end of file
+const Filter &Collector::filter() const {
+  return *m_filter;
+}
+
+ObjectFilter &ObjectFilter::add(const std::string &key, std::unique_ptr<Filter> &&filter) {
+  // the map's nodes, and so the views of its keys, stay put as it grows
+  // a new key is appended to the matcher, only the perfect hash is redone
+  auto [it, added] = m_key_filters.insert_or_assign(key, std::move(filter));
+  if (!added) {
+    for (KeyEntry &entry : m_keys)
+      if (entry.key == key)
+        entry.filter = it->second.get();
+    return *this;
+  }
+  std::string_view k = it->first;
+  size_t n = k.size();
+  m_keys.push_back({{detail::loadWord(k.data(), std::min<size_t>(n, 8)),
+                     detail::loadWord(k.data() + std::min<size_t>(n, 8), std::min<size_t>(n, 16) - std::min<size_t>(n, 8))},
+                    k, it->second.get()});
+  m_lengths |= 1ull << std::min<size_t>(n, 63);
+  m_prefilter.add(k);
+  rehash();
+  return *this;
+}
+
+void ObjectFilter::rehash() {
+  // a perfect hash of the keys while there are few enough of them
+  m_slots.clear();
+  m_seed = -1;
+  if (m_keys.size() <= linearKeys || m_keys.size() > hashedKeys)
+    return;
+  std::vector<std::string_view> keys;
+  for (const KeyEntry &entry : m_keys)
+    keys.push_back(entry.key);
+  size_t slots = detail::perfectSlots(keys.size());
+  m_seed = detail::perfectSeed(keys, slots);
+  if (m_seed < 0)
+    return;
+  m_slots.assign(slots, -1);
+  for (size_t k = 0; k < keys.size(); k++)
+    m_slots[detail::keyHash(keys[k], m_seed) & (slots - 1)] = int(k);
+}
+
+bool ObjectFilter::sameKey(const KeyEntry &entry, std::string_view key) {
+  size_t n = key.size();
+  if (n != entry.key.size())
+    return false;
+  if (n > 16)
+    return key == entry.key;
+  size_t low = std::min<size_t>(n, 8);
+  return detail::loadWord(key.data(), low) == entry.words[0]
+      && detail::loadWord(key.data() + low, n - low) == entry.words[1];
+}
+
+bool ObjectFilter::containsKey(std::string_view s) const {
+  return m_key_filters.contains(s);
+}
+
+const Filter &ObjectFilter::at(std::string_view s) const {
+  return *m_key_filters.find(s)->second;
+}
+
+const Filter *ObjectFilter::keep(const Value &value) const {
+  if (value.isObject())
+    return this;
+  else
+    return nullptr;
+}
+
+const Filter *ObjectFilter::keepKey(std::string_view key) const {
+  // most keys are rejected, by their length alone where possible
+  if (!(m_lengths >> std::min<size_t>(key.size(), 63) & 1))
+    return nullptr;
+  if (m_seed >= 0) {
+    int k = m_slots[detail::keyHash(key, m_seed) & (m_slots.size() - 1)];
+    return k >= 0 && sameKey(m_keys[k], key) ? m_keys[k].filter : nullptr;
+  }
+  if (m_keys.size() <= linearKeys) {
+    for (const KeyEntry &entry : m_keys)
+      if (sameKey(entry, key))
+        return entry.filter;
+    return nullptr;
+  }
+  auto it = m_key_filters.find(key);
+  if (it == m_key_filters.end())
+    return nullptr;
+  return it->second.get();
+}
+
+namespace
+{
+  // <0, 0 or >0 as a is less, equal or greater, integers compared exactly
+  int compare(Number a, Number b) {
+    if (a.isInteger() && b.isInteger())
+      return (a.asInteger() > b.asInteger()) - (a.asInteger() < b.asInteger());
+    double x = a.isInteger() ? double(a.asInteger()) : a.asDouble();
+    double y = b.isInteger() ? double(b.asInteger()) : b.asDouble();
+    return (x > y) - (x < y);
+  }
+
+  bool holds(Predicate::Op op, int order) {
+    switch (op) {
+    case Predicate::Equal: return order == 0;
+    case Predicate::NotEqual: return order != 0;
+    case Predicate::Less: return order < 0;
+    case Predicate::LessEqual: return order <= 0;
+    case Predicate::Greater: return order > 0;
+    case Predicate::GreaterEqual: return order >= 0;
+    default: return false;
+    }
+  }
+} // namespace
+
+bool Predicate::test(std::string_view value) const {
+  if (op == Exists)
+    return true;
+  if (op == Prefix)
+    return value.starts_with(string);
+  if (type != Type::String)
+    return op == NotEqual;
+  return holds(op, value.compare(string));
+}
+
+bool Predicate::test(Number value) const {
+  if (op == Exists)
+    return true;
+  if (type != Type::Number)
+    return op == NotEqual;
+  return holds(op, compare(value, number));
+}
+
+bool Predicate::test(bool value) const {
+  if (op == Exists)
+    return value;
+  if (type != Type::Boolean)
+    return op == NotEqual;
+  return holds(op, int(value) - int(boolean));
+}
+
+bool Predicate::testNull() const {
+  if (op == Exists)
+    return false;
+  if (type != Type::Null)
+    return op == NotEqual;
+  return holds(op, 0);
+}
+
+bool Predicate::operator==(const Predicate &other) const {
+  return op == other.op && path == other.path && type == other.type && string == other.string
+      && boolean == other.boolean && (type != Type::Number || compare(number, other.number) == 0);
+}
+
+ArrayFilter &ArrayFilter::add(int idx, std::unique_ptr<Filter> &&filter) {
+  m_idx_filters[idx] = std::move(filter);
+  return *this;
+}
+
+ArrayFilter &ArrayFilter::setOthers(std::unique_ptr<Filter> &&filter) {
+  m_others = std::move(filter);
+  return *this;
+}
+
+bool ArrayFilter::containsIdx(int i) const {
+  return m_idx_filters.contains(i);
+}
+
+const Filter &ArrayFilter::at(int i) const {
+  return *m_idx_filters.at(i);
+}
+
+const Filter *ArrayFilter::keep(const Value &value) const {
+  if (value.isArray())
+    return this;
+  else
+    return nullptr;
+}
+
+const Filter *ArrayFilter::keepIdx(int idx) const {
+  auto it = m_idx_filters.find(idx);
+  if (it == m_idx_filters.end())
+    return m_others.get();
+  return it->second.get();
+}
+
+int ArrayFilter::indexLimit() const {
+  if (m_others)
+    return -1;
+  int limit = 0;
+  for (auto &[idx, filter] : m_idx_filters)
+    limit = std::max(limit, idx + 1);
+  return limit;
+}
+
+namespace
+{
+  using Predicates = std::vector<Predicate>;
+
+  // One step of a path expression: .key, [idx], [] or select(...)
+  struct Step {
+    enum Kind { Key, Index, Each, Select } kind;
+    std::string key{};
+    int idx = 0;
+    std::shared_ptr<const Predicates> predicates{};
+  };
+  using Path = std::vector<Step>;
+  using Paths = std::vector<Path>;
+
+  /**
+   * @brief Trie of every compiled path, merged on common prefixes.
+   * Each index child also contains the paths of `each`, so the emitted
+   * ArrayFilter entries are complete on their own.
+   * A selected value only has the paths after its select(), other paths
+   * can't be merged with those unless they keep the whole value.
+  */
+  struct Node {
+    bool all = false; // keep the whole value
+    std::map<std::string, std::unique_ptr<Node>, std::less<>> keys;
+    std::map<int, std::unique_ptr<Node>> indices;
+    std::unique_ptr<Node> each;
+    std::shared_ptr<const Predicates> select;
+    std::unique_ptr<Node> selected; // the paths after select
+
+    void keepAll() {
+      all = true;
+      keys.clear();
+      indices.clear();
+      each.reset();
+      select.reset();
+      selected.reset();
+    }
+
+    std::unique_ptr<Node> clone() const {
+      auto n = std::make_unique<Node>();
+      n->all = all;
+      for (auto &[k, v] : keys)
+        n->keys.emplace(k, v->clone());
+      for (auto &[i, v] : indices)
+        n->indices.emplace(i, v->clone());
+      if (each)
+        n->each = each->clone();
+      n->select = select;
+      if (selected)
+        n->selected = selected->clone();
+      return n;
+    }
+
+    /**
+     * @return false if path selects the value other than the paths so far
+    */
+    bool insert(const Path &path, size_t pos = 0) {
+      if (all)
+        return true;
+      if (pos == path.size()) {
+        keepAll();
+        return true;
+      }
+      const Step &step = path[pos];
+      if (step.kind == Step::Select) {
+        if (keys.size() || indices.size() || each || (select && *select != *step.predicates))
+          return false;
+        select = step.predicates;
+        if (!selected)
+          selected = std::make_unique<Node>();
+        return selected->insert(path, pos + 1);
+      }
+      if (select)
+        return false;
+      if (step.kind == Step::Key) {
+        if (indices.size() || each) {
+          // value can't be both an object and an array, keep it whole
+          keepAll();
+          return true;
+        }
+        auto &child = keys[step.key];
+        if (!child)
+          child = std::make_unique<Node>();
+        return child->insert(path, pos + 1);
+      }
+      if (keys.size()) {
+        keepAll();
+        return true;
+      }
+      if (step.kind == Step::Index) {
+        auto &child = indices[step.idx];
+        if (!child)
+          child = each ? each->clone() : std::make_unique<Node>();
+        return child->insert(path, pos + 1);
+      }
+      if (!each)
+        each = std::make_unique<Node>();
+      bool merged = each->insert(path, pos + 1);
+      for (auto &[i, child] : indices)
+        merged = child->insert(path, pos + 1) && merged;
+      return merged;
+    }
+
+    // the SelectFilter of a selected value, nullptr if a predicate's path
+    // runs into another select()
+    std::unique_ptr<Filter> emitSelect() const {
+      // select(a) | select(b) is select(a and b)
+      Predicates predicates;
+      const Node *node = this;
+      for (; node->select; node = node->selected.get())
+        predicates.insert(predicates.end(), node->select->begin(), node->select->end());
+      if (predicates.size() > SelectFilter::maxPredicates)
+        return nullptr;
+      auto scan = node->clone();
+      for (const Predicate &p : predicates) {
+        Path path;
+        for (const std::string &key : p.path)
+          path.push_back({Step::Key, key});
+        if (!scan->insert(path))
+          return nullptr;
+      }
+      auto filter = node->emit();
+      auto scanned = scan->emit();
+      if (!filter || !scanned)
+        return nullptr;
+      return std::make_unique<SelectFilter>(std::move(predicates), std::move(filter), std::move(scanned));
+    }
+
+    // nullptr if a select() can't be emitted, see emitSelect()
+    std::unique_ptr<Filter> emit() const {
+      if (all)
+        return std::make_unique<Identity>();
+      if (select)
+        return emitSelect();
+      if (keys.size() || (indices.empty() && !each)) {
+        auto f = std::make_unique<ObjectFilter>();
+        for (auto &[k, v] : keys) {
+          auto child = v->emit();
+          if (!child)
+            return nullptr;
+          f->add(k, std::move(child));
+        }
+        return f;
+      }
+      auto others = each ? each->emit() : nullptr;
+      if (each && !others)
+        return nullptr;
+      if (indices.empty())
+        return std::make_unique<Collector>(std::move(others));
+      auto f = std::make_unique<ArrayFilter>();
+      for (auto &[i, v] : indices) {
+        auto child = v->emit();
+        if (!child)
+          return nullptr;
+        f->add(i, std::move(child));
+      }
+      if (others)
+        f->setOthers(std::move(others));
+      return f;
+    }
+  };
+
+  /**
+   * @brief Recursive descent compiler for the filter expression grammar:
+   *   pipe   := union ('|' union)*
+   *   union  := term (',' term)*
+   *   term   := path | object | '(' pipe ')' | select
+   *   path   := '.' [name | string | bracket] ('.' (name | string) | bracket)*
+   *   bracket:= '[' ']' | '[' integer ']' | '[' string ']'
+   *   object := '{' [entry (',' entry)*] '}'
+   *   entry  := (name | string) [':' term ('|' term)*]
+   *   select := 'select' '(' cond ('and' cond)* ')'
+   *   cond   := keys [('==' | '!=' | '<' | '<=' | '>' | '>=') literal]
+   *           | keys '|' 'startswith' '(' string ')'
+   * where keys is a path of keys only and literal a JSON scalar.
+   * Every expression is expanded into the list of paths it keeps.
+  */
+  class Compiler {
+  public:
+    Compiler(std::string_view str) : m_str{str} {}
+
+    bool compile(Node &root) {
+      Paths paths;
+      if (!parsePipe(paths))
+        return false;
+      skipWhitespace();
+      if (m_pos != m_str.size())
+        return false;
+      for (auto &p : paths)
+        if (!root.insert(p))
+          return false;
+      return true;
+    }
+
+  private:
+    std::string_view m_str;
+    size_t m_pos = 0;
+
+    void skipWhitespace() {
+      while (m_pos < m_str.size() && isspace((unsigned char)m_str[m_pos]))
+        m_pos++;
+    }
+
+    bool peek(char c) {
+      skipWhitespace();
+      return m_pos < m_str.size() && m_str[m_pos] == c;
+    }
+
+    bool accept(char c) {
+      if (!peek(c))
+        return false;
+      m_pos++;
+      return true;
+    }
+
+    bool acceptWord(std::string_view word) {
+      skipWhitespace();
+      size_t end = m_pos + word.size();
+      if (m_str.substr(m_pos, word.size()) != word || (end < m_str.size() && isNameChar(m_str[end])))
+        return false;
+      m_pos = end;
+      return true;
+    }
+
+    static bool isNameChar(char c) {
+      return isalnum((unsigned char)c) || c == '_';
+    }
+
+    static Paths concat(const Paths &lhs, const Paths &rhs) {
+      Paths out;
+      for (auto &l : lhs) {
+        for (auto &r : rhs) {
+          Path p = l;
+          p.insert(p.end(), r.begin(), r.end());
+          out.push_back(std::move(p));
+        }
+      }
+      return out;
+    }
+
+    bool parsePipe(Paths &out) {
+      if (!parseUnion(out))
+        return false;
+      while (accept('|')) {
+        Paths rhs;
+        if (!parseUnion(rhs))
+          return false;
+        out = concat(out, rhs);
+      }
+      return true;
+    }
+
+    bool parseUnion(Paths &out) {
+      do {
+        Paths term;
+        if (!parseTerm(term))
+          return false;
+        out.insert(out.end(), term.begin(), term.end());
+      } while (accept(','));
+      return true;
+    }
+
+    bool parseTerm(Paths &out) {
+      if (accept('(')) {
+        return parsePipe(out) && accept(')');
+      }
+      if (peek('{'))
+        return parseObject(out);
+      if (acceptWord("select"))
+        return parseSelect(out);
+      if (peek('.')) {
+        Path p;
+        if (!parsePath(p))
+          return false;
+        out.push_back(std::move(p));
+        return true;
+      }
+      return false;
+    }
+
+    bool parseName(std::string &name) {
+      skipWhitespace();
+      if (m_pos < m_str.size() && m_str[m_pos] == '"')
+        return parseQuoted(name);
+      size_t start = m_pos;
+      while (m_pos < m_str.size() && isNameChar(m_str[m_pos]))
+        m_pos++;
+      if (m_pos == start || isdigit((unsigned char)m_str[start]))
+        return false;
+      name = m_str.substr(start, m_pos - start);
+      return true;
+    }
+
+    bool parseQuoted(std::string &name) {
+      // m_str[m_pos] == '"', only \" and \\ escapes are needed in keys
+      m_pos++;
+      while (m_pos < m_str.size() && m_str[m_pos] != '"') {
+        if (m_str[m_pos] == '\\' && m_pos + 1 < m_str.size())
+          m_pos++;
+        name += m_str[m_pos++];
+      }
+      if (m_pos == m_str.size())
+        return false;
+      m_pos++;
+      return true;
+    }
+
+    bool parseBracket(Path &p) {
+      // '[' already consumed
+      if (accept(']')) {
+        p.push_back({Step::Each});
+        return true;
+      }
+      if (peek('"')) {
+        std::string key;
+        if (!parseQuoted(key))
+          return false;
+        p.push_back({Step::Key, std::move(key)});
+        return accept(']');
+      }
+      size_t start = m_pos;
+      while (m_pos < m_str.size() && isdigit((unsigned char)m_str[m_pos]))
+        m_pos++;
+      if (m_pos == start || m_pos - start > 9)
+        return false;
+      p.push_back({Step::Index, {}, std::stoi(std::string{m_str.substr(start, m_pos - start)})});
+      return accept(']');
+    }
+
+    bool parsePath(Path &p) {
+      // first '.' may stand alone (identity) or be followed by a step
+      accept('.');
+      if (m_pos < m_str.size() && (isNameChar(m_str[m_pos]) || m_str[m_pos] == '"')) {
+        std::string key;
+        if (!parseName(key))
+          return false;
+        p.push_back({Step::Key, std::move(key)});
+      } else if (m_pos < m_str.size() && m_str[m_pos] == '[') {
+        m_pos++;
+        if (!parseBracket(p))
+          return false;
+      }
+      while (true) {
+        if (m_pos < m_str.size() && m_str[m_pos] == '[') {
+          m_pos++;
+          if (!parseBracket(p))
+            return false;
+        } else if (m_pos < m_str.size() && m_str[m_pos] == '.') {
+          m_pos++;
+          if (m_pos < m_str.size() && m_str[m_pos] == '[')
+            continue;
+          std::string key;
+          if (!parseName(key))
+            return false;
+          p.push_back({Step::Key, std::move(key)});
+        } else {
+          return true;
+        }
+      }
+    }
+
+    bool parseSelect(Paths &out) {
+      // "select" already consumed
+      auto predicates = std::make_shared<Predicates>();
+      if (!accept('('))
+        return false;
+      do {
+        Predicate p;
+        if (!parseCondition(p))
+          return false;
+        predicates->push_back(std::move(p));
+      } while (acceptWord("and"));
+      if (!accept(')') || predicates->size() > SelectFilter::maxPredicates)
+        return false;
+      out.push_back({{Step::Select, {}, 0, std::move(predicates)}});
+      return true;
+    }
+
+    bool parseCondition(Predicate &p) {
+      Path path;
+      if (!peek('.') || !parsePath(path))
+        return false;
+      for (Step &step : path) {
+        if (step.kind != Step::Key)
+          return false;
+        p.path.push_back(std::move(step.key));
+      }
+      if (accept('|')) {
+        p.op = Predicate::Prefix;
+        p.type = Type::String;
+        return acceptWord("startswith") && accept('(') && peek('"') && parseQuoted(p.string) && accept(')');
+      }
+      static const std::pair<std::string_view, Predicate::Op> ops[] = {
+        {"==", Predicate::Equal}, {"!=", Predicate::NotEqual}, {"<=", Predicate::LessEqual},
+        {">=", Predicate::GreaterEqual}, {"<", Predicate::Less}, {">", Predicate::Greater}};
+      skipWhitespace();
+      for (auto [text, op] : ops) {
+        if (m_str.substr(m_pos, text.size()) == text) {
+          m_pos += text.size();
+          p.op = op;
+          return parseLiteral(p);
+        }
+      }
+      p.op = Predicate::Exists;
+      return true;
+    }
+
+    bool parseLiteral(Predicate &p) {
+      if (peek('"')) {
+        p.type = Type::String;
+        return parseQuoted(p.string);
+      }
+      for (bool b : {true, false}) {
+        if (acceptWord(b ? "true" : "false")) {
+          p.type = Type::Boolean;
+          p.boolean = b;
+          return true;
+        }
+      }
+      p.type = acceptWord("null") ? Type::Null : Type::Number;
+      if (p.type == Type::Null)
+        return true;
+      // integers are kept exact, like the Parser does
+      const char *begin = m_str.data() + m_pos;
+      const char *end = m_str.data() + m_str.size();
+      long long i;
+      auto [ptr, ec] = std::from_chars(begin, end, i);
+      if (ec == std::errc{} && (ptr == end || (*ptr != '.' && *ptr != 'e' && *ptr != 'E'))) {
+        p.number = Number{i};
+      } else {
+        double d;
+        auto parsed = std::from_chars(begin, end, d);
+        if (parsed.ec != std::errc{})
+          return false;
+        ptr = parsed.ptr;
+        p.number = Number{d};
+      }
+      m_pos = ptr - m_str.data();
+      return true;
+    }
+
+    bool parseObject(Paths &out) {
+      accept('{');
+      if (accept('}'))
+        return true;
+      do {
+        std::string key;
+        if (!parseName(key))
+          return false;
+        Paths value{Path{}};
+        if (accept(':')) {
+          value.clear();
+          if (!parseTerm(value))
+            return false;
+          while (accept('|')) {
+            Paths rhs;
+            if (!parseTerm(rhs))
+              return false;
+            value = concat(value, rhs);
+          }
+        }
+        Paths prefixed = concat({Path{{Step::Key, key}}}, value);
+        out.insert(out.end(), prefixed.begin(), prefixed.end());
+      } while (accept(','));
+      return accept('}');
+    }
+  };
+} // namespace
+
+std::unique_ptr<Filter> Filter::from_string(std::string_view str) {
+  Node root;
+  if (!Compiler{str}.compile(root))
+    return nullptr;
+  return root.emit();
+}
+
+std::unique_ptr<Filter> Filter::from_strings(const std::vector<std::string> &strs) {
+  Node root;
+  for (auto &str : strs) {
+    if (!Compiler{str}.compile(root))
+      return nullptr;
+  }
+  return root.emit();
+}
@@ -0,0 +1,324 @@
+#include "filteredjson/handler.hpp"
+
+#include <bit>
+#include <cassert>
+
+using namespace FilteredJSON;
+
+void DomBuilder::reset(){
+    m_document.clear();
+    m_root = &m_document.root();
+    m_open.clear();
+    m_member = nullptr;
+}
+
+void DomBuilder::setRoot(Value &root){
+    m_root = &root;
+    m_open.clear();
+    m_member = nullptr;
+}
+
+Value &DomBuilder::next(){
+    //where the next value goes: the root slot, a new element of the innermost
+    //array, or the member added by the last onKey()
+    if(m_open.empty())
+        return *m_root;
+    Value &parent = *m_open.back();
+    if(parent.isArray())
+        return parent.toArray().append();
+    assert(m_member);
+    Value &v = *m_member;
+    m_member = nullptr;
+    return v;
+}
+
+void DomBuilder::onObjectStart(){
+    Value &v = next();
+    v = Object{m_document.allocator()};
+    m_open.push_back(&v);
+}
+
+void DomBuilder::onKey(std::string_view key, bool copy){
+    assert(!m_open.empty() && m_open.back()->isObject());
+    Allocator alloc = m_document.allocator();
+    Object &o = m_open.back()->toObject();
+    m_member = &(o.add(copy ? String{key, alloc} : String::view(key, alloc)) = {});
+}
+
+void DomBuilder::onObjectEnd(){
+    m_open.pop_back();
+}
+
+void DomBuilder::onArrayStart(){
+    Value &v = next();
+    v = Array{m_document.allocator()};
+    m_open.push_back(&v);
+}
+
+void DomBuilder::onArrayEnd(){
+    m_open.pop_back();
+}
+
+void DomBuilder::onString(std::string_view value, bool copy){
+    Allocator alloc = m_document.allocator();
+    next() = copy ? String{value, alloc} : String::view(value, alloc);
+}
+
+void DomBuilder::onNumber(Number value){
+    next() = value;
+}
+
+void DomBuilder::onBoolean(bool value){
+    next() = Boolean{value};
+}
+
+void DomBuilder::onNull(){
+    next() = {};
+}
+
+void Serializer::onObjectStart(){
+    separate();
+    m_out->put('{');
+    m_separate = false;
+}
+
+void Serializer::onKey(std::string_view key, bool){
+    separate();
+    String::view(key).serialize(*m_out);
+    m_out->put(':');
+    m_separate = false;
+}
+
+void Serializer::onObjectEnd(){
+    m_out->put('}');
+    m_separate = true;
+}
+
+void Serializer::onArrayStart(){
+    separate();
+    m_out->put('[');
+    m_separate = false;
+}
+
+void Serializer::onArrayEnd(){
+    m_out->put(']');
+    m_separate = true;
+}
+
+void Serializer::onString(std::string_view value, bool){
+    separate();
+    String::view(value).serialize(*m_out);
+    m_separate = true;
+}
+
+void Serializer::onNumber(Number value){
+    separate();
+    value.serialize(*m_out);
+    m_separate = true;
+}
+
+void Serializer::onBoolean(bool value){
+    separate();
+    m_out->write(value ? "true" : "false");
+    m_separate = true;
+}
+
+void Serializer::onNull(){
+    separate();
+    m_out->write("null");
+    m_separate = true;
+}
+
+void Serializer::onDocumentEnd(){
+    m_out->put('\n');
+    m_separate = false;
+}
+
+void Selection::begin(const SelectFilter &filter, Handler &output){
+    m_select = &filter;
+    m_output = &output;
+    m_open.clear();
+    size_t n = filter.predicates().size();
+    m_all = n < 64 ? (1ull << n) - 1 : ~0ull;
+    m_decided = 0;
+    m_failed = false;
+    m_passed = false;
+    m_events.clear();
+    m_text.clear();
+}
+
+bool Selection::end(){
+    //predicates whose path never turned up see null
+    const auto &predicates = m_select->predicates();
+    for(size_t p = 0; p < predicates.size() && !m_failed; p++)
+        if(!(m_decided >> p & 1) && !predicates[p].testNull())
+            m_failed = true;
+    if(!m_failed && !m_passed)
+        flush();
+    m_events.clear();
+    m_text.clear();
+    return !m_failed;
+}
+
+const Filter *Selection::beginValue(uint64_t &candidates){
+    //the filter of the value starting, nullptr if it isn't kept,
+    //and the predicates looking at it or into it
+    if(m_open.empty()){
+        candidates = m_all;
+        return &m_select->filter();
+    }
+    Level &parent = m_open.back();
+    if(parent.array){
+        candidates = 0;
+        return parent.filter ? parent.filter->keepIdx(parent.index++) : nullptr;
+    }
+    candidates = m_keyCandidates;
+    return m_keyFilter;
+}
+
+template<typename Test>
+void Selection::decide(uint64_t candidates, Test test){
+    //test the predicates whose path ends at the value starting
+    //once all of them hold, pass on what was held back
+    const auto &predicates = m_select->predicates();
+    for(candidates &= ~m_decided; candidates; candidates &= candidates - 1){
+        int p = std::countr_zero(candidates);
+        if(predicates[p].path.size() != m_open.size())
+            continue;
+        m_decided |= 1ull << p;
+        if(!test(predicates[p]))
+            m_failed = true;
+    }
+    if(m_decided != m_all || m_failed || m_passed)
+        return;
+    m_passed = true;
+    flush();
+    m_events.clear();
+    m_text.clear();
+}
+
+void Selection::flush(){
+    //pass on the events held back
+    for(const Event &event : m_events){
+        if(event.data)
+            send(event, {event.data, event.size}, false);
+        else
+            send(event, std::string_view{m_text}.substr(event.offset, event.size), true);
+    }
+}
+
+void Selection::emit(Event event, std::string_view text, bool copy){
+    //pass on once decided, otherwise hold back, copying what won't stay valid
+    if(m_failed)
+        return;
+    if(m_passed){
+        send(event, text, copy);
+        return;
+    }
+    event.size = text.size();
+    if(copy){
+        event.offset = m_text.size();
+        m_text.append(text);
+    }else{
+        event.data = text.data();
+    }
+    m_events.push_back(event);
+}
+
+void Selection::send(const Event &event, std::string_view text, bool copy){
+    switch(event.kind){
+        case Kind::ObjectStart: m_output->onObjectStart(); break;
+        case Kind::Key:         m_output->onKey(text, copy); break;
+        case Kind::ObjectEnd:   m_output->onObjectEnd(); break;
+        case Kind::ArrayStart:  m_output->onArrayStart(); break;
+        case Kind::ArrayEnd:    m_output->onArrayEnd(); break;
+        case Kind::String:      m_output->onString(text, copy); break;
+        case Kind::Number:      m_output->onNumber(event.number); break;
+        case Kind::Boolean:     m_output->onBoolean(event.boolean); break;
+        case Kind::Null:        m_output->onNull(); break;
+    }
+}
+
+void Selection::onObjectStart(){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [](const Predicate &p){ return p.testContainer(); });
+    if(f)
+        emit({Kind::ObjectStart});
+    m_open.push_back({f, candidates, false, 0});
+}
+
+void Selection::onKey(std::string_view key, bool copy){
+    //the key of the selected value itself comes before it
+    if(m_open.empty()){
+        emit({Kind::Key}, key, copy);
+        return;
+    }
+    const Level &object = m_open.back();
+    size_t depth = m_open.size() - 1;
+    const auto &predicates = m_select->predicates();
+    m_keyFilter = object.filter ? object.filter->keepKey(key) : nullptr;
+    m_keyCandidates = 0;
+    for(uint64_t c = object.candidates & ~m_decided; c; c &= c - 1){
+        int p = std::countr_zero(c);
+        if(predicates[p].path.size() > depth && predicates[p].path[depth] == key)
+            m_keyCandidates |= 1ull << p;
+    }
+    if(m_keyFilter)
+        emit({Kind::Key}, key, copy);
+}
+
+void Selection::onObjectEnd(){
+    bool kept = m_open.back().filter;
+    m_open.pop_back();
+    if(kept)
+        emit({Kind::ObjectEnd});
+}
+
+void Selection::onArrayStart(){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [](const Predicate &p){ return p.testContainer(); });
+    if(f)
+        emit({Kind::ArrayStart});
+    m_open.push_back({f, candidates, true, 0});
+}
+
+void Selection::onArrayEnd(){
+    bool kept = m_open.back().filter;
+    m_open.pop_back();
+    if(kept)
+        emit({Kind::ArrayEnd});
+}
+
+void Selection::onString(std::string_view value, bool copy){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [&](const Predicate &p){ return p.test(value); });
+    if(f)
+        emit({Kind::String}, value, copy);
+}
+
+void Selection::onNumber(Number value){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [&](const Predicate &p){ return p.test(value); });
+    if(f)
+        emit({Kind::Number, false, value});
+}
+
+void Selection::onBoolean(bool value){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [&](const Predicate &p){ return p.test(value); });
+    if(f)
+        emit({Kind::Boolean, value});
+}
+
+void Selection::onNull(){
+    uint64_t candidates;
+    const Filter *f = beginValue(candidates);
+    decide(candidates, [](const Predicate &p){ return p.testNull(); });
+    if(f)
+        emit({Kind::Null});
+}
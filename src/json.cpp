@@ -1,8 +1,12 @@
 #include "filteredjson/json.hpp"
+#include "filteredjson/writer.hpp"
 
 #define INDENT 2
 
 #include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstring>
 
 // #define DEBUG_PRINTF(...) printf("[FilteredJSON] " __VA_ARGS__)
 #define DEBUG_PRINTF(...) 
@@ -13,162 +17,349 @@ using namespace FilteredJSON;
 Value::Value() : m_type{Type::Null} {
     DEBUG_PRINTF("null Value()\n");
 }
-Value::Value(String s) : m_type{Type::String}, s{s} { DEBUG_PRINTF("Value(String)\n"); }
-Value::Value(Number n) : m_type{Type::Number}, n{n} { DEBUG_PRINTF("Value(Number)\n"); }
-Value::Value(Object o) : m_type{Type::Object}, o{o} { DEBUG_PRINTF("Value(Object)\n"); }
-Value::Value(Array a) : m_type{Type::Array}, a{a} { DEBUG_PRINTF("Value(Array)\n"); }
-Value::Value(Boolean b) : m_type{Type::Boolean}, b{b} { DEBUG_PRINTF("Value(Boolean)\n"); }
-Value::Value(const Value &v) { *this = v; DEBUG_PRINTF("Value(const Value&)\n"); }
-Value::Value(Value &&v) { *this = std::move(v); DEBUG_PRINTF("Value(Value&&)\n"); }
-Value::~Value(){ DEBUG_PRINTF("~Value()\n"); }
+// allocate the out of line node from the same resource as its contents
+template<typename T>
+static T *newNode(T &&v){
+    Allocator alloc = v.get_allocator();
+    return alloc.new_object<T>(std::move(v));
+}
+
+template<typename T>
+static T *copyNode(const T &v, Allocator alloc){
+    return alloc.new_object<T>(v);
+}
+
+template<typename T>
+static Allocator allocatorOf(const T *v){
+    return v->get_allocator();
+}
+
+template<typename T>
+static void deleteNode(T *v){
+    Allocator alloc = v->get_allocator();
+    alloc.delete_object(v);
+}
+
+Value::Value(String s) : m_type{Type::String} { u.s = newNode(std::move(s)); DEBUG_PRINTF("Value(String)\n"); }
+Value::Value(Number n) : m_type{Type::Number}, m_integer{n.isInteger()} {
+    if(m_integer)
+        u.i = n.asInteger();
+    else
+        u.d = n.asDouble();
+    DEBUG_PRINTF("Value(Number)\n");
+}
+Value::Value(Object o) : m_type{Type::Object} { u.o = newNode(std::move(o)); DEBUG_PRINTF("Value(Object)\n"); }
+Value::Value(Array a) : m_type{Type::Array} { u.a = newNode(std::move(a)); DEBUG_PRINTF("Value(Array)\n"); }
+Value::Value(Boolean b) : m_type{Type::Boolean} { u.b = b; DEBUG_PRINTF("Value(Boolean)\n"); }
+Value::Value(const Allocator &) : m_type{Type::Null} { DEBUG_PRINTF("null Value(alloc)\n"); }
+// plain copies go to the default resource so they outlive the source's Document
+Value::Value(const Value &v) : m_type{Type::Null} { copyFrom(v, {}); DEBUG_PRINTF("Value(const Value&)\n"); }
+Value::Value(const Value &v, const Allocator &alloc) : m_type{Type::Null} { copyFrom(v, alloc); DEBUG_PRINTF("Value(const Value&, alloc)\n"); }
+Value::Value(Value &&v) noexcept : m_type{v.m_type}, m_integer{v.m_integer} {
+    DEBUG_PRINTF("Value(Value&&)\n");
+    u = v.u;
+    v.m_type = Type::Null;
+}
+Value::Value(Value &&v, const Allocator &alloc) : m_type{Type::Null} {
+    DEBUG_PRINTF("Value(Value&&, alloc)\n");
+    //steal the node if it already lives in alloc's resource, copy it there otherwise
+    bool same = true;
+    switch(v.m_type){
+        case Type::String:  same = allocatorOf(v.u.s) == alloc; break;
+        case Type::Array:   same = allocatorOf(v.u.a) == alloc; break;
+        case Type::Object:  same = allocatorOf(v.u.o) == alloc; break;
+        default: break;
+    }
+    if(same)
+        *this = std::move(v);
+    else
+        copyFrom(v, alloc);
+}
+Value::~Value(){ DEBUG_PRINTF("~Value()\n"); nullify(); }
 Value &Value::operator=(const Value& v){
     DEBUG_PRINTF("Value=(const Value&)\n");
-    nullify();
-    m_type = v.m_type;
-    switch(m_type){
-        case Type::Boolean: b = v.b; break;
-        case Type::Number:  n = v.n; break;
-        case Type::String:  s = v.s; break;
-        case Type::Array:   a = v.a; break;
-        case Type::Object:  o = v.o; break;
-    }
+    if(this == &v)
+        return *this;
+    //like the std::pmr containers the target keeps its allocator, so a value
+    //replaced inside a Document's tree is copied into its arena. Nulls and
+    //scalars hold no allocator, copies into them use the default resource
+    auto held = [this]() -> Allocator {
+        switch(m_type){
+            case Type::String:  return allocatorOf(u.s);
+            case Type::Array:   return allocatorOf(u.a);
+            case Type::Object:  return allocatorOf(u.o);
+            default:            return {};
+        }
+    };
+    copyFrom(v, held());
     return *this;
 }
 
-Value &Value::operator=(Value&& v){
+void Value::copyFrom(const Value &v, const Allocator &alloc){
+    //copy before releasing, v may be a child of this value
+    auto copy = v.u;
+    switch(v.m_type){
+        case Type::String:  copy.s = copyNode(*v.u.s, alloc); break;
+        case Type::Array:   copy.a = copyNode(*v.u.a, alloc); break;
+        case Type::Object:  copy.o = copyNode(*v.u.o, alloc); break;
+        default: break;
+    }
+    Type type = v.m_type;
+    bool integer = v.m_integer;
+    nullify();
+    u = copy;
+    m_type = type;
+    m_integer = integer;
+}
+
+Value &Value::operator=(Value&& v) noexcept {
     DEBUG_PRINTF("Value=(Value&&)\n");
+    if(this == &v)
+        return *this;
+    //take ownership before releasing, v may be a child of this value
+    auto taken = v.u;
+    Type type = v.m_type;
+    bool integer = v.m_integer;
+    v.m_type = Type::Null;
     nullify();
-    m_type = v.m_type;
-    switch(m_type){
-        case Type::Boolean: b = std::move(v.b); break;
-        case Type::Number:  n = std::move(v.n); break;
-        case Type::String:  s = std::move(v.s); break;
-        case Type::Array:   a = std::move(v.a); break;
-        case Type::Object:  o = std::move(v.o); break;
-    }
+    u = taken;
+    m_type = type;
+    m_integer = integer;
     return *this;
 }
 
 void Value::nullify(){
+    //free the out of line value, if any, and become null
     DEBUG_PRINTF("nullify()\n");
-    s = {};
-    n = {};
-    o = {};
-    a = {};
-    b = {};
+    switch(m_type){
+        case Type::String:  deleteNode(u.s); break;
+        case Type::Array:   deleteNode(u.a); break;
+        case Type::Object:  deleteNode(u.o); break;
+        default: break;
+    }
+    m_type = Type::Null;
     DEBUG_PRINTF("1nullify() done\n");
 }
 
 std::string Value::stringify(int indent) const{
+    BufferWriter out;
+    serialize(out, indent);
+    return out.take();
+}
+
+void Value::serialize(Writer &out, int indent) const{
     switch(m_type){
-        case Type::Object:  return o.stringify(indent);
-        case Type::Array:   return a.stringify(indent);
-        case Type::String:  return s.stringify(indent);
-        case Type::Number:  return n.stringify(indent);
-        case Type::Boolean: return b.stringify(indent);
+        case Type::Object:  return u.o->serialize(out, indent);
+        case Type::Array:   return u.a->serialize(out, indent);
+        case Type::String:  return u.s->serialize(out, indent);
+        case Type::Number:  return toNumber().serialize(out, indent);
+        case Type::Boolean: return toBoolean().serialize(out, indent);
         case Type::Null: {
-            return "null";
+            return out.write("null");
         }
     }
     assert(false);
 }
 
-Object &Value::toObject() { assert(m_type == Type::Object); return o; }
-const Object &Value::toObject() const { assert(m_type == Type::Object); return o; }
-Array &Value::toArray() { assert(m_type == Type::Array); return a; }
-const Array &Value::toArray() const { assert(m_type == Type::Array); return a; }
-String &Value::toString() { assert(m_type == Type::String); return s; }
-const String &Value::toString() const { assert(m_type == Type::String); return s; }
-Number &Value::toNumber() { assert(m_type == Type::Number); return n; }
-const Number &Value::toNumber() const { assert(m_type == Type::Number); return n; }
-Boolean &Value::toBoolean() { assert(m_type == Type::Boolean); return b; }
-const Boolean &Value::toBoolean() const { assert(m_type == Type::Boolean); return b; }
+Object &Value::toObject() { assert(m_type == Type::Object); return *u.o; }
+const Object &Value::toObject() const { assert(m_type == Type::Object); return *u.o; }
+Array &Value::toArray() { assert(m_type == Type::Array); return *u.a; }
+const Array &Value::toArray() const { assert(m_type == Type::Array); return *u.a; }
+String &Value::toString() { assert(m_type == Type::String); return *u.s; }
+const String &Value::toString() const { assert(m_type == Type::String); return *u.s; }
+Number Value::toNumber() const {
+    assert(m_type == Type::Number);
+    if(m_integer)
+        return Number{u.i};
+    return Number{u.d};
+}
+Boolean Value::toBoolean() const { assert(m_type == Type::Boolean); return Boolean{u.b}; }
 
 Object::~Object(){}
-Object::Object(const Object &o) : Super{o} { DEBUG_PRINTF("Object(const Object&)\n"); }
-Object::Object(Object &&o) : Super{std::move(o)} { DEBUG_PRINTF("Object(Object&&)\n"); }
-Value &Object::operator[](std::string_view k) { return Super::operator[](std::string{k}); }
-const Value &Object::operator[](std::string_view k) const { return Super::at(std::string{k}); }
-Object &Object::operator=(const Object &o) { Super::operator=(o); return *this; }
-Object &Object::operator=(Object &&o) { Super::operator=(std::move(o)); return *this; }
-std::string Object::stringify(int indent) const{
-    DEBUG_PRINTF("Object stringify(%d)\n", indent);
-    std::string out;
-    if(indent != -1){
-        out += "{";
-        bool b = false;
-        if(Super::size())
-            out += '\n';
-        for(auto &[k, v] : *this){
-            if(b) {
-                out += ",\n";
-            }
-            out += std::string(indent+INDENT, ' ');
-            out += '"' + k + "\": ";
-            out += v.stringify(indent+INDENT*2);
-            b = true;
+Object::Object(const Allocator &alloc) : m_members{alloc}, m_index{alloc} {}
+// members keep their positions, so the index is copied along with them
+Object::Object(const Object &o) : m_members{o.m_members}, m_index{o.m_index} { DEBUG_PRINTF("Object(const Object&)\n"); }
+Object::Object(const Object &o, const Allocator &alloc) : m_members{o.m_members, alloc}, m_index{o.m_index, alloc} { DEBUG_PRINTF("Object(const Object&, alloc)\n"); }
+Object::Object(Object &&o) : m_members{std::move(o.m_members)}, m_index{std::move(o.m_index)} { DEBUG_PRINTF("Object(Object&&)\n"); }
+Object::Object(Object &&o, const Allocator &alloc) : m_members{std::move(o.m_members), alloc}, m_index{std::move(o.m_index), alloc} { DEBUG_PRINTF("Object(Object&&, alloc)\n"); }
+Object &Object::operator=(const Object &o) { m_members = o.m_members; m_index = o.m_index; return *this; }
+Object &Object::operator=(Object &&o) { m_members = std::move(o.m_members); m_index = std::move(o.m_index); return *this; }
+
+Object::iterator Object::find(std::string_view k) {
+    const Member *m = lookup(k);
+    return m ? m_members.begin() + (m - m_members.data()) : m_members.end();
+}
+
+Object::const_iterator Object::find(std::string_view k) const {
+    const Member *m = lookup(k);
+    return m ? m_members.begin() + (m - m_members.data()) : m_members.end();
+}
+
+Value &Object::operator[](std::string_view k) {
+    if(const Member *m = lookup(k))
+        return const_cast<Value&>(m->second);
+    return add(String{k, get_allocator()});
+}
+
+const Value &Object::operator[](std::string_view k) const {
+    const Member *m = lookup(k);
+    assert(m);
+    return m->second;
+}
+
+Value &Object::add(String &&key) {
+    if(const Member *m = lookup(key))
+        return const_cast<Value&>(m->second);
+    //index as soon as the object is large, so a const lookup never builds it
+    m_members.emplace_back(std::move(key), Value{});
+    if(m_index.size())
+        indexMember(m_members.size() - 1);
+    else if(m_members.size() >= indexThreshold)
+        buildIndex();
+    return m_members.back().second;
+}
+
+const Object::Member *Object::lookup(std::string_view k) const {
+    //small objects: compare lengths first, then chars
+    if(m_members.size() < indexThreshold){
+        for(auto &m : m_members){
+            std::string_view key = m.first;
+            if(key.size() == k.size() && key == k)
+                return &m;
         }
-        out += "\n";
-        out += std::string(indent, ' ');
-        out += "}";
-    } else{
-        out += "{";
-        bool b = false;
-        for(auto &[k, v] : *this){
-            DEBUG_PRINTF("Stringifying key: (%s)\n", k.begin());
-            if(b) out += ',';
-            out += '"';
-            out += k;
-            out += "\":";
-            out += v.stringify(-1);
-            b = true;
+        return nullptr;
+    }
+    assert(!m_index.empty());
+    size_t mask = m_index.size() - 1;
+    for(size_t h = std::hash<std::string_view>{}(k) & mask; m_index[h]; h = (h + 1) & mask){
+        const Member &m = m_members[m_index[h] - 1];
+        if(m.first == k)
+            return &m;
+    }
+    return nullptr;
+}
+
+void Object::buildIndex() {
+    //at least twice as many slots as members, a power of 2
+    size_t slots = 32;
+    while(slots < m_members.size() * 2)
+        slots *= 2;
+    m_index.assign(slots, 0);
+    for(size_t i = 0; i < m_members.size(); i++)
+        indexMember(i);
+}
+
+void Object::indexMember(size_t pos) {
+    if(m_members.size() * 2 > m_index.size()){
+        buildIndex();
+        return;
+    }
+    size_t mask = m_index.size() - 1;
+    size_t h = std::hash<std::string_view>{}(m_members[pos].first) & mask;
+    while(m_index[h])
+        h = (h + 1) & mask;
+    m_index[h] = pos + 1;
+}
+
+// newline and indent spaces before a pretty printed member
+static void writeIndent(Writer &out, int indent){
+    static constexpr std::string_view spaces = "                                ";
+    out.put('\n');
+    for(; indent > (int)spaces.size(); indent -= spaces.size())
+        out.write(spaces);
+    out.write(spaces.substr(0, indent));
+}
+
+// write s as a JSON string literal, escaping quotes, backslashes and control chars
+static void writeString(Writer &out, std::string_view s){
+    static constexpr char hex[] = "0123456789abcdef";
+    out.put('"');
+    if(s.empty())
+        return out.put('"');
+    const char *run = s.data();
+    const char *end = run + s.size();
+    for(const char *p = run; p != end; ++p){
+        unsigned char c = *p;
+        if(c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        out.write({run, size_t(p - run)});
+        run = p + 1;
+        switch(c){
+            case '"':   out.write("\\\""); break;
+            case '\\':  out.write("\\\\"); break;
+            case '\b':  out.write("\\b"); break;
+            case '\f':  out.write("\\f"); break;
+            case '\n':  out.write("\\n"); break;
+            case '\r':  out.write("\\r"); break;
+            case '\t':  out.write("\\t"); break;
+            default: {
+                char u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                out.write({u, sizeof(u)});
+            }
         }
-        out += "}";
     }
-    return out;
+    out.write({run, size_t(end - run)});
+    out.put('"');
+}
+
+std::string Object::stringify(int indent) const{
+    DEBUG_PRINTF("Object stringify(%d)\n", indent);
+    BufferWriter out;
+    serialize(out, indent);
+    return out.take();
+}
+
+void Object::serialize(Writer &out, int indent) const{
+    //indent -1 is compact, otherwise one member per line indented by INDENT more
+    out.put('{');
+    bool b = false;
+    for(auto &[k, v] : *this){
+        if(b) out.put(',');
+        if(indent != -1)
+            writeIndent(out, indent+INDENT);
+        writeString(out, k);
+        out.write(indent != -1 ? ": " : ":");
+        v.serialize(out, indent != -1 ? indent+INDENT : -1);
+        b = true;
+    }
+    if(b && indent != -1)
+        writeIndent(out, indent);
+    out.put('}');
 }
 
 Array::~Array(){};
 Array::Array(const Array &a) : m_values{a.m_values} { DEBUG_PRINTF("Array(const Array&)\n"); }
+Array::Array(const Array &a, const Allocator &alloc) : m_values{a.m_values, alloc} { DEBUG_PRINTF("Array(const Array&, alloc)\n"); }
 Array::Array(Array &&a) : m_values{std::move(a.m_values)} { DEBUG_PRINTF("Array(Array&&)\n"); }
+Array::Array(Array &&a, const Allocator &alloc) : m_values{std::move(a.m_values), alloc} { DEBUG_PRINTF("Array(Array&&, alloc)\n"); }
 Value &Array::operator[](int i) { return m_values[i]; }
 const Value &Array::operator[](int i) const { return m_values.at(i); }
 Array &Array::operator=(const Array &a) { m_values = a.m_values; return *this; }
 Array &Array::operator=(Array &&a) { m_values = std::move(a.m_values); return *this; }
 Value& Array::append(const Value &v) { m_values.push_back(v); return m_values.back(); }
-Value& Array::append() { m_values.push_back({}); return m_values.back(); }
+Value& Array::append(Value &&v) { m_values.push_back(std::move(v)); return m_values.back(); }
+Value& Array::append() { m_values.emplace_back(); return m_values.back(); }
 std::string Array::stringify(int indent) const{
     DEBUG_PRINTF("Array stringify(%d)\n", indent);
-    std::string out;
-    if(indent != -1){
-        out += "[";
-        bool b = false;
-        if(m_values.size())
-            out += " \n";
-        for(auto &v : m_values){
-            if(b) {
-                out += ",\n";
-            }
-            out += std::string(indent+INDENT, ' ');
-            out += v.stringify(indent+INDENT);
-            b = true;
-        }
-        if(m_values.size()){
-            out += "\n";
-            out += std::string(indent, ' ');
-        }
-        out += "]";
-    } else{
-        out += "[";
-        bool b = false;
-        for(auto &v : m_values){
-            if(b) out += ',';
-            out += v.stringify(-1);
-            b = true;
-        }
-        out += "]";
+    BufferWriter out;
+    serialize(out, indent);
+    return out.take();
+}
+
+void Array::serialize(Writer &out, int indent) const{
+    //indent -1 is compact, otherwise one element per line indented by INDENT more
+    out.put('[');
+    bool b = false;
+    for(auto &v : m_values){
+        if(b) out.put(',');
+        if(indent != -1)
+            writeIndent(out, indent+INDENT);
+        v.serialize(out, indent != -1 ? indent+INDENT : -1);
+        b = true;
     }
-    return out;
+    if(b && indent != -1)
+        writeIndent(out, indent);
+    out.put(']');
 }
 
 Boolean::Boolean(bool b) : m_value{b} { DEBUG_PRINTF("Boolean(bool)\n"); }
@@ -182,25 +373,116 @@ std::string Boolean::stringify(int indent) const{
     std::string out = m_value?"true":"false";
     return out;
 }
+void Boolean::serialize(Writer &out, int indent) const{
+    out.write(m_value ? "true" : "false");
+}
+
+String::String(const String &s) : String{s.getValue()} {}
+String::String(const String &s, const Allocator &alloc) : String{s.getValue(), alloc} {}
+String::String(String &&s) noexcept : m_alloc{s.m_alloc} { steal(s); }
+String::String(String &&s, const Allocator &alloc) : m_alloc{alloc} {
+    //views and same-resource chars move, anything else is copied into alloc
+    if(!s.m_owned || s.m_alloc == alloc)
+        steal(s);
+    else
+        setValue(s.getValue());
+}
+String::String(std::string &&s) : String{std::string_view{s}} {}
+String::String(std::string_view s, const Allocator &alloc) : m_alloc{alloc} { setValue(s); }
+String::~String(){ release(); }
+
+String String::view(std::string_view s, const Allocator &alloc){
+    String out{alloc};
+    out.m_data = s.data();
+    out.m_size = s.size();
+    return out;
+}
+
+void String::setValue(std::string_view s){
+    //copy first, s may view our own chars
+    char *data = nullptr;
+    if(s.size()){
+        data = (char*)m_alloc.allocate_bytes(s.size(), 1);
+        memcpy(data, s.data(), s.size());
+    }
+    release();
+    m_data = data;
+    m_size = s.size();
+    m_owned = data != nullptr;
+}
+
+void String::release(){
+    if(m_owned)
+        m_alloc.deallocate_bytes((void*)m_data, m_size, 1);
+    m_data = nullptr;
+    m_size = 0;
+    m_owned = false;
+}
+
+void String::steal(String &s){
+    m_data = s.m_data;
+    m_size = s.m_size;
+    m_owned = s.m_owned;
+    s.m_data = nullptr;
+    s.m_size = 0;
+    s.m_owned = false;
+}
+
+String &String::operator=(const String &s){
+    if(this != &s)
+        setValue(s.getValue());
+    return *this;
+}
+
+String &String::operator=(String &&s){
+    //the allocator stays, so only views and same-resource chars can be taken over
+    if(this == &s)
+        return *this;
+    if(!s.m_owned || s.m_alloc == m_alloc){
+        release();
+        steal(s);
+    }else{
+        setValue(s.getValue());
+    }
+    return *this;
+}
 
 std::string String::stringify(int indent) const{
     DEBUG_PRINTF("String stringify(%d)\n", indent);
-    std::string out;
-    out += '"';
-    out += m_value;
-    out += '"';
-    return out;
+    BufferWriter out;
+    serialize(out, indent);
+    return out.take();
+}
+void String::serialize(Writer &out, int indent) const{
+    writeString(out, getValue());
 }
 
 Number::IntType Number::asInteger() const { assert(isInteger()); return i; }
 Number::FloatType Number::asDouble() const { assert(isDouble()); return d; }
+// shortest text that reads back as the same value, doubles keep a '.' or an
+// exponent so they do not read back as integers, JSON has no inf or nan
+static std::string_view formatNumber(const Number &n, char (&buf)[32]){
+    if(n.isInteger()){
+        auto res = std::to_chars(buf, buf + sizeof(buf), n.asInteger());
+        return {buf, size_t(res.ptr - buf)};
+    }
+    double d = n.asDouble();
+    if(!std::isfinite(d))
+        return "null";
+    char *end = std::to_chars(buf, buf + sizeof(buf) - 2, d).ptr;
+    if(!std::memchr(buf, '.', end - buf) && !std::memchr(buf, 'e', end - buf)){
+        *end++ = '.';
+        *end++ = '0';
+    }
+    return {buf, size_t(end - buf)};
+}
+
 std::string Number::stringify(int indent) const{
     DEBUG_PRINTF("Number stringify(%d)\n", indent);
-    std::string out;
-    if(m_intNotDouble){
-        out = std::to_string(i);
-    }else{
-        out = std::to_string(d);
-    }
-    return out;
+    char buf[32];
+    return std::string{formatNumber(*this, buf)};
+}
+void Number::serialize(Writer &out, int indent) const{
+    char buf[32];
+    out.write(formatNumber(*this, buf));
 }
@@ -0,0 +1,264 @@
+#include "filteredjson/lazy.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <limits>
+
+using namespace FilteredJSON;
+
+Type LazyValue::getType() const{
+    assert(exists());
+    switch(m_document->m_input[m_document->m_tape[m_entry].offset]){
+        case '{':   return Type::Object;
+        case '[':   return Type::Array;
+        case '"':   return Type::String;
+        case 't':
+        case 'f':   return Type::Boolean;
+        case 'n':   return Type::Null;
+        default:    return Type::Number;
+    }
+}
+
+size_t LazyValue::size() const{
+    Type type = getType();
+    if(type != Type::Object && type != Type::Array)
+        return 0;
+    const auto &tape = m_document->m_tape;
+    return tape[tape[m_entry].link].link;
+}
+
+LazyValue LazyValue::operator[](std::string_view key) const{
+    //walk the keys, stepping over each member's value in one go
+    if(!exists() || getType() != Type::Object)
+        return {};
+    const LazyDocument &doc = *m_document;
+    uint32_t close = doc.m_tape[m_entry].link;
+    for(uint32_t i = m_entry + 1; i < close; i = doc.next(i + 1)){
+        const LazyDocument::Entry &k = doc.m_tape[i];
+        std::string_view text = doc.m_input.substr(k.offset + 1, k.link - k.offset - 1);
+        //escaped keys have to be decoded before comparing
+        bool match = memchr(text.data(), '\\', text.size())
+            ? doc.materialize(i).toString() == key
+            : text == key;
+        if(match)
+            return {m_document, i + 1};
+    }
+    return {};
+}
+
+LazyValue LazyValue::operator[](size_t i) const{
+    if(!exists() || getType() != Type::Array)
+        return {};
+    const LazyDocument &doc = *m_document;
+    uint32_t close = doc.m_tape[m_entry].link;
+    uint32_t e = m_entry + 1;
+    for(; i && e < close; i--)
+        e = doc.next(e);
+    if(e >= close)
+        return {};
+    return {m_document, e};
+}
+
+const Value &LazyValue::get() const{
+    assert(exists());
+    return m_document->materialize(m_entry);
+}
+
+std::string_view LazyValue::raw() const{
+    assert(exists());
+    return m_document->raw(m_entry);
+}
+
+// text of a number or literal, up to the char that ends it
+static std::string_view scalarText(std::string_view input, size_t offset){
+    size_t end = input.find_first_of(",:}]\" \t\r\n", offset);
+    return input.substr(offset, end == input.npos ? input.npos : end - offset);
+}
+
+// a JSON number or literal, as the Parser would read it
+static bool validScalar(std::string_view s){
+    if(s == "true" || s == "false" || s == "null")
+        return true;
+    auto digits = [&](size_t i){
+        size_t from = i;
+        while(i < s.size() && s[i] >= '0' && s[i] <= '9')
+            i++;
+        return i > from ? i : std::string_view::npos;
+    };
+    size_t i = s.starts_with('-') ? 1 : 0;
+    if(i < s.size() && s[i] == '0')
+        i++;
+    else if((i = digits(i)) == s.npos)
+        return false;
+    if(i < s.size() && s[i] == '.' && (i = digits(i + 1)) == s.npos)
+        return false;
+    if(i < s.size() && (s[i] == 'e' || s[i] == 'E')){
+        i++;
+        if(i < s.size() && (s[i] == '+' || s[i] == '-'))
+            i++;
+        if((i = digits(i)) == s.npos)
+            return false;
+    }
+    return i == s.size();
+}
+
+// the escapes of a string's text between its quotes
+static bool validEscapes(std::string_view s){
+    for(size_t i = s.find('\\'); i != s.npos; i = s.find('\\', i)){
+        if(i + 1 == s.size())
+            return false;
+        char c = s[i + 1];
+        if(c == 'u'){
+            if(i + 6 > s.size())
+                return false;
+            for(size_t h = i + 2; h < i + 6; h++)
+                if(!std::isxdigit((unsigned char)s[h]))
+                    return false;
+            i += 6;
+        }else if(std::string_view{"\"\\/bfnrt"}.find(c) != s.npos){
+            i += 2;
+        }else{
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LazyDocument::parse(std::string_view input){
+    //walk the structural index keeping a stack of open objects and arrays
+    //and how many values each has so far, keys included.
+    //What may come next is tracked so separators and keys are checked,
+    //and scalars and escapes are checked as they turn up, so get() can't fail
+    clear();
+    if(input.size() >= std::numeric_limits<uint32_t>::max())
+        return false;
+    m_input = input;
+    constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+    enum class Expect : uint8_t{ Value, ValueOrClose, Key, KeyOrClose, Colon, CommaOrClose, End };
+    Expect expect = Expect::Value;
+    std::vector<uint32_t> open;
+    std::vector<uint32_t> counts;
+    uint32_t string = none;     //> string entry waiting for its closing quote
+    auto inObject = [&]{ return !open.empty() && input[m_tape[open.back()].offset] == '{'; };
+    auto addValue = [&](uint32_t offset){
+        if(!open.empty())
+            counts.back()++;
+        m_tape.push_back({offset, 0});
+    };
+    auto valueExpected = [&]{ return expect == Expect::Value || expect == Expect::ValueOrClose; };
+    auto endValue = [&]{ expect = open.empty() ? Expect::End : Expect::CommaOrClose; };
+    for(size_t base = 0; base < input.size(); base += indexWindow){
+        for(uint32_t position : m_indexer.index(input.substr(base, indexWindow))){
+            uint32_t p = base + position;
+            char c = input[p];
+            if(string != none){
+                //the next entry after an opening quote is the closing one
+                uint32_t begin = m_tape[string].offset + 1;
+                if(!validEscapes(input.substr(begin, p - begin)))
+                    return false;
+                m_tape[string].link = p;
+                string = none;
+                continue;
+            }
+            switch(c){
+                case '{':
+                case '[':
+                    if(!valueExpected())
+                        return false;
+                    addValue(p);
+                    open.push_back(m_tape.size() - 1);
+                    counts.push_back(0);
+                    expect = c == '{' ? Expect::KeyOrClose : Expect::ValueOrClose;
+                    break;
+                case '}':
+                case ']':{
+                    bool object = c == '}';
+                    if(open.empty() || inObject() != object)
+                        return false;
+                    if(expect != Expect::CommaOrClose && expect != (object ? Expect::KeyOrClose : Expect::ValueOrClose))
+                        return false;
+                    uint32_t count = object ? counts.back() / 2 : counts.back();
+                    m_tape[open.back()].link = m_tape.size();
+                    m_tape.push_back({p, count});
+                    open.pop_back();
+                    counts.pop_back();
+                    endValue();
+                    break;
+                }
+                case ':':
+                    if(expect != Expect::Colon)
+                        return false;
+                    expect = Expect::Value;
+                    break;
+                case ',':
+                    if(expect != Expect::CommaOrClose)
+                        return false;
+                    expect = inObject() ? Expect::Key : Expect::Value;
+                    break;
+                case '"':
+                    if(expect == Expect::Key || expect == Expect::KeyOrClose)
+                        expect = Expect::Colon;
+                    else if(valueExpected())
+                        endValue();
+                    else
+                        return false;
+                    string = m_tape.size();
+                    addValue(p);
+                    break;
+                default:
+                    if(!valueExpected() || !validScalar(scalarText(input, p)))
+                        return false;
+                    addValue(p);
+                    endValue();
+            }
+        }
+    }
+    return open.empty() && string == none && expect == Expect::End;
+}
+
+LazyValue LazyDocument::root() const{
+    if(m_tape.empty())
+        return {};
+    return {this, 0};
+}
+
+void LazyDocument::clear(){
+    //parsed values live in the document's arena, drop them before it goes
+    m_values.clear();
+    m_document.clear();
+    m_tape.clear();
+    m_indexer.reset();
+    m_input = {};
+}
+
+uint32_t LazyDocument::next(uint32_t entry) const{
+    //entry after the value at entry, past its closing bracket if it has one
+    char c = m_input[m_tape[entry].offset];
+    if(c == '{' || c == '[')
+        return m_tape[entry].link + 1;
+    return entry + 1;
+}
+
+std::string_view LazyDocument::raw(uint32_t entry) const{
+    const Entry &e = m_tape[entry];
+    char c = m_input[e.offset];
+    if(c == '{' || c == '[')
+        return m_input.substr(e.offset, m_tape[e.link].offset + 1 - e.offset);
+    if(c == '"')
+        return m_input.substr(e.offset, e.link + 1 - e.offset);
+    size_t end = m_input.find_first_of(",}] \t\r\n", e.offset);
+    return m_input.substr(e.offset, end == m_input.npos ? m_input.npos : end - e.offset);
+}
+
+const Value &LazyDocument::materialize(uint32_t entry) const{
+    //parse the value's text on first access, strings view the input
+    auto [it, added] = m_values.try_emplace(entry);
+    if(added){
+        m_builder.setRoot(it->second);
+        //parse() already rejected any text this could fail on
+        [[maybe_unused]] bool valid = m_parser.parseAll(raw(entry));
+        assert(valid);
+    }
+    return it->second;
+}
@@ -0,0 +1,291 @@
+#include "filteredjson/parallel.hpp"
+#include "filteredjson/parser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace FilteredJSON;
+
+ParallelParser::ParallelParser(const Filter *filter, unsigned threads, size_t chunkSize, size_t window)
+    : m_filter{filter}, m_threads{threads}, m_chunkSize{std::max<size_t>(chunkSize, 1)}, m_window{window} {
+    if(!m_threads)
+        m_threads = std::max(1u, std::thread::hardware_concurrency());
+    if(!m_window)
+        m_window = 2 * m_threads;
+}
+
+// cut input into chunks of at least chunkSize bytes that end after a newline,
+// or at the end of the input
+static std::vector<std::string_view> splitLines(std::string_view input, size_t chunkSize){
+    std::vector<std::string_view> chunks;
+    while(!input.empty()){
+        size_t cut = input.size();
+        if(chunkSize < input.size()){
+            const char *nl = (const char*)memchr(input.data() + chunkSize, '\n', input.size() - chunkSize);
+            if(nl)
+                cut = nl - input.data() + 1;
+        }
+        chunks.push_back(input.substr(0, cut));
+        input.remove_prefix(cut);
+    }
+    return chunks;
+}
+
+namespace
+{
+    // lexical state at a position of the input, enough to follow the nesting
+    // of the root without parsing
+    struct ScanState{
+        bool inString = false;
+        bool escape = false;
+        int depth = 0;
+    };
+
+    // advance s over [p, end), calling onTopLevel(p) for each ',' between
+    // elements of the root and for the bracket closing the root
+    template<typename F>
+    void scan(ScanState &s, const char *p, const char *end, F &&onTopLevel){
+        for(; p != end; ++p){
+            char c = *p;
+            if(s.inString){
+                if(s.escape)
+                    s.escape = false;
+                else if(c == '\\')
+                    s.escape = true;
+                else if(c == '"')
+                    s.inString = false;
+                continue;
+            }
+            switch(c){
+                case '"':
+                    s.inString = true;
+                    break;
+                case '[': case '{':
+                    s.depth++;
+                    break;
+                case ']': case '}':
+                    if(--s.depth == 0)
+                        onTopLevel(p);
+                    break;
+                case ',':
+                    if(s.depth == 1)
+                        onTopLevel(p);
+                    break;
+            }
+        }
+    }
+
+    // run f(0) .. f(n-1) on up to threads threads
+    template<typename F>
+    void forEach(size_t n, unsigned threads, F &&f){
+        std::atomic<size_t> next = 0;
+        std::vector<std::jthread> pool;
+        for(unsigned t = 0; t < std::min<size_t>(threads, n); t++){
+            pool.emplace_back([&]{
+                for(size_t i; (i = next++) < n;)
+                    f(i);
+            });
+        }
+    }
+
+    bool isWhitespace(std::string_view s){
+        return s.find_first_not_of(" \t\r\n") == s.npos;
+    }
+} // namespace
+
+bool ParallelParser::parseArray(std::string_view input, Document &document){
+    document.clear();
+    size_t first = input.find_first_not_of(" \t\r\n");
+    size_t ranges = std::min<size_t>(m_threads, input.size() / m_chunkSize);
+    //a filter keeping no element ends the array at its '[', nothing to split,
+    //and a select() of the root is decided by the whole array, not a piece of it
+    bool keepsElements = !m_filter || m_filter->indexLimit() != 0;
+    bool rootSelect = m_filter && m_filter->select();
+    if(first == input.npos || input[first] != '[' || ranges < 2 || !keepsElements || rootSelect){
+        DomBuilder builder{document};
+        Parser parser{builder};
+        parser.setFilter(m_filter);
+        return parser.parseAll(input);
+    }
+
+    //range boundaries, moved past backslashes so no range starts on an escaped char
+    std::vector<const char*> bounds(ranges + 1);
+    const char *end = input.data() + input.size();
+    bounds[0] = input.data();
+    bounds[ranges] = end;
+    for(size_t r = 1; r < ranges; r++){
+        const char *b = std::max(bounds[r - 1], input.data() + input.size() * r / ranges);
+        while(b != end && b != input.data() && b[-1] == '\\')
+            b++;
+        bounds[r] = b;
+    }
+
+    //speculative pass, each range from outside and from inside a string
+    struct Guess{ ScanState outside, inside; };
+    std::vector<Guess> guesses(ranges);
+    auto ignore = [](const char*){};
+    forEach(ranges, m_threads, [&](size_t r){
+        guesses[r].inside.inString = true;
+        scan(guesses[r].outside, bounds[r], bounds[r + 1], ignore);
+        scan(guesses[r].inside, bounds[r], bounds[r + 1], ignore);
+    });
+
+    //chain the guesses into the real state at each range start
+    std::vector<ScanState> starts(ranges);
+    for(size_t r = 1; r < ranges; r++){
+        const ScanState &prev = starts[r - 1];
+        const ScanState &guess = prev.inString ? guesses[r - 1].inside : guesses[r - 1].outside;
+        starts[r] = {guess.inString, false, prev.depth + guess.depth};
+    }
+
+    //exact pass, first top level ',' and count of them in each range
+    struct Split{
+        const char *comma = nullptr;
+        size_t commas = 0;
+        const char *close = nullptr;
+    };
+    std::vector<Split> splits(ranges);
+    forEach(ranges, m_threads, [&](size_t r){
+        Split &split = splits[r];
+        ScanState state = starts[r];
+        scan(state, bounds[r], bounds[r + 1], [&](const char *p){
+            if(*p != ','){
+                if(!split.close)
+                    split.close = p;
+            }else if(!split.close){
+                if(!split.comma)
+                    split.comma = p;
+                split.commas++;
+            }
+        });
+    });
+
+    //pieces of elements between the splits, with the index of their first element
+    struct Piece{
+        std::string_view text;
+        int index;
+        Document *document;
+        bool valid = false;
+    };
+    std::vector<Piece> pieces;
+    const char *begin = input.data() + first + 1;
+    const char *close = nullptr;
+    int index = 0;
+    int commas = 0;
+    for(size_t r = 0; r < ranges && !close; r++){
+        const Split &split = splits[r];
+        if(split.comma){
+            pieces.push_back({{begin, size_t(split.comma - begin)}, index, nullptr});
+            begin = split.comma + 1;
+            index = commas + 1;
+        }
+        commas += split.commas;
+        close = split.close;
+    }
+    if(!close || *close != ']' || !isWhitespace({close + 1, size_t(end - close - 1)}))
+        return false;
+    pieces.push_back({{begin, size_t(close - begin)}, index, nullptr});
+    for(Piece &piece : pieces){
+        //with a split on either side a piece needs an element, "[1,]" is not an array
+        if(pieces.size() > 1 && isWhitespace(piece.text))
+            return false;
+        piece.document = &document.subDocument(piece.text.size());
+    }
+
+    //parse each piece as the contents of an array, numbered from its index
+    forEach(pieces.size(), m_threads, [&](size_t i){
+        Piece &piece = pieces[i];
+        DomBuilder builder{*piece.document};
+        Parser parser{builder};
+        parser.setFilter(m_filter);
+        parser.borrowing = true;
+        parser.parseContinue("[");
+        parser.arrayIndex.back() = piece.index;
+        parser.parseContinue(piece.text);
+        parser.parseContinue("]");
+        parser.finish();
+        piece.valid = parser.isValid();
+    });
+
+    //splice the elements in order, the sub-documents share the arena group
+    //so they move without a copy
+    size_t total = 0;
+    for(const Piece &piece : pieces){
+        if(!piece.valid)
+            return false;
+        total += piece.document->root().toArray().size();
+    }
+    document.root() = Array{document.allocator()};
+    Array &root = document.root().toArray();
+    root.reserve(total);
+    for(const Piece &piece : pieces){
+        Array &elements = piece.document->root().toArray();
+        for(size_t i = 0; i < elements.size(); i++)
+            root.append(std::move(elements[i]));
+    }
+    return true;
+}
+
+bool ParallelParser::parse(std::string_view input, Writer &out){
+    //workers claim chunks in order while they are within the window of the
+    //output and fill the chunk's slot, the calling thread writes the slots
+    //out in order and so moves the window on
+    std::vector<std::string_view> chunks = splitLines(input, m_chunkSize);
+    std::vector<Slot> slots(m_window);
+    std::mutex mutex;
+    std::condition_variable filled, freed;
+    size_t next = 0;
+    size_t written = 0;
+
+    auto work = [&]{
+        Parser parser;
+        parser.setFilter(m_filter);
+        BufferWriter text;
+        parser.setMultiDocument(true, [&](Value &root){
+            root.serialize(text);
+            text.put('\n');
+        });
+        std::unique_lock lock{mutex};
+        while(true){
+            freed.wait(lock, [&]{ return next == chunks.size() || next < written + m_window; });
+            if(next == chunks.size())
+                return;
+            size_t i = next++;
+            lock.unlock();
+            text.clear();
+            bool valid = parser.parseAll(chunks[i]);
+            //the slot belongs to chunk i until it is written
+            Slot &slot = slots[i % m_window];
+            slot.text.assign(text.view());
+            slot.valid = valid;
+            lock.lock();
+            slot.ready = true;
+            filled.notify_all();
+        }
+    };
+
+    bool valid = true;
+    {
+        std::vector<std::jthread> pool;
+        for(unsigned t = 0; t < std::min<size_t>(m_threads, chunks.size()); t++)
+            pool.emplace_back(work);
+        std::unique_lock lock{mutex};
+        while(written < chunks.size()){
+            Slot &slot = slots[written % m_window];
+            filled.wait(lock, [&]{ return slot.ready; });
+            lock.unlock();
+            out.write(slot.text);
+            valid &= slot.valid;
+            lock.lock();
+            slot.ready = false;
+            written++;
+            freed.notify_all();
+        }
+    }
+    return valid;
+}
@@ -1,15 +1,64 @@
 #include "filteredjson/parser.hpp"
 
 #include "assert.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
-// #define DEBUG_PRINTF(...) printf("[JP] " __VA_ARGS__)
-// #define DEBUG_PRINTF2(...) printf( __VA_ARGS__)
+#if FILTEREDJSON_TRACE
+#include <cstdio>
+#define DEBUG_PRINTF(...) printf("[JP] " __VA_ARGS__)
+#define DEBUG_PRINTF2(...) printf( __VA_ARGS__)
+#else
 #define DEBUG_PRINTF(...)
 #define DEBUG_PRINTF2(...)
+#endif
+
+//counting for stats(), compiled out unless enabled
+#if FILTEREDJSON_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
 
 
 using namespace FilteredJSON;
+
+//JSON whitespace, unlike isspace() not locale dependent
+static inline bool isWhitespace(char c){
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// filter used when the parser has none set, keeps the whole document
+static const Identity keepAll;
+
+// find the first '"' or '\\' in [p, end), or end if there is none
+// scans 8 bytes per step using SWAR byte compares
+static const char *findQuoteOrBackslash(const char *p, const char *end){
+    constexpr uint64_t ones = 0x0101010101010101ull;
+    constexpr uint64_t highs = 0x8080808080808080ull;
+    if constexpr(std::endian::native == std::endian::little){
+        while(end - p >= 8){
+            uint64_t v;
+            memcpy(&v, p, 8);
+            uint64_t q = v ^ (ones * '"');
+            uint64_t b = v ^ (ones * '\\');
+            //high bit set in each byte that was zero, exact up to the first match
+            uint64_t m = ((q - ones) & ~q & highs) | ((b - ones) & ~b & highs);
+            if(m)
+                return p + (std::countr_zero(m) >> 3);
+            p += 8;
+        }
+    }
+    while(p != end && *p != '"' && *p != '\\')
+        ++p;
+    return p;
+}
+
 #define elem(x) [((int)Parser::State::x)] = #x
 
 const char* Parser::state_strs[] = {
@@ -23,12 +72,16 @@ const char* Parser::state_strs[] = {
     elem(ArrayValue),
     elem(ArrayComma),
     elem(String),
+    elem(StringEscape),
+    elem(StringUnicode),
     elem(Number),
     elem(TrueStart),
     elem(FalseStart),
     elem(NullStart),
+    elem(Skip),
     elem(Error),
     elem(Stop),
+    elem(Done),
 };
 void Parser::printStateStack(){
 
@@ -45,39 +98,169 @@ Parser::Parser(){
     reset();
 }
 
+Parser::Parser(const Filter &filter) : rootFilter{&filter} {
+    DEBUG_PRINTF("Parser(const Filter&)\n");
+    reset();
+}
+
+Parser::Parser(Handler &handler) : handler{&handler} {
+    DEBUG_PRINTF("Parser(Handler&)\n");
+    reset();
+}
+
+Parser::Parser(Handler &handler, const Filter &filter) : rootFilter{&filter}, handler{&handler} {
+    DEBUG_PRINTF("Parser(Handler&, const Filter&)\n");
+    reset();
+}
+
 bool Parser::isValid() const{
-    return currentState() == State::Stop && !error;
+    //between documents a multi-document parser is back at Start
+    if(multiDocument)
+        return state.size() == 1 && currentState() == State::Start && !error;
+    return (currentState() == State::Stop || currentState() == State::Done) && !error;
 }
 
 Value &Parser::getValue() {
     assert(isValid());
-    return rootValue;
+    assert(handler == &builder);
+    return document.root();
 }
 
 void Parser::reset(){
     //reset the parser internal states
     DEBUG_PRINTF("reset()\n");
-    while(state.size()){
-        DEBUG_PRINTF("popping state\n");
-        state.pop_back();
-    }
+    state.clear();
     state.push_back(State::Start);
     DEBUG_PRINTF("state set\n");
-    while(branch.size()){
-        DEBUG_PRINTF("popping branch\n");
-        branch.pop_back();
-    }
-    branch.push_back(&rootValue);
-    DEBUG_PRINTF("root branch set\n");
-    rootValue = {};
+    builder.reset();
+    filters.clear();
+    filters.push_back(rootFilter ? rootFilter : &keepAll);
+    arrayIndex.clear();
+    limits.clear();
+    if(selecting)
+        handler = &selections[0].selection->output();
+    selecting = 0;
+    rootDropped = false;
+    error = false;
+    keyPrefilter = nullptr;
+    keyRejected = false;
+    highSurrogate = 0;
+    skipCopy = false;
+    serializer.reset();
+    indexer.reset();
     DEBUG_PRINTF("reset() done\n");
 }
 
-void Parser::parseContinue(std::string_view data){
+void Parser::setFilter(const Filter *filter){
+    //filter applies from the root value, so the parser starts over
+    rootFilter = filter;
+    reset();
+}
+
+void Parser::setHandler(Handler *h){
+    //events of a half parsed value would be meaningless to the new handler
+    reset();
+    handler = h ? h : &builder;
+    passthrough = false;
+}
+
+void Parser::setPassthrough(Writer *out){
+    //the Serializer writes the structure around what tryParseValue() copies
+    reset();
+    serializer.setWriter(out);
+    handler = out ? static_cast<Handler*>(&serializer) : &builder;
+    passthrough = out;
+}
+
+void Parser::setMultiDocument(bool enable, std::function<void(Value&)> callback){
+    multiDocument = enable;
+    documentCallback = std::move(callback);
+    reset();
+}
+
+void Parser::useStructuralIndex(bool enable, StructuralIndexer::Kernel kernel){
+    indexing = enable;
+    indexer = StructuralIndexer{kernel};
+    reset();
+}
+
+Parser::Stats Parser::stats() const{
+    static_assert(stateCount == size_t(State::Done) + 1);
+    Stats s = counters;
+    s.keptBytes = s.bytes - s.skippedBytes;
+    STATS(s.allocations = document.allocations() - countedAllocations;)
+    return s;
+}
+
+void Parser::clearStats(){
+    counters = {};
+    countedAllocations = document.allocations();
+}
+
+Parser::Status Parser::parseContinue(std::string_view data){
+    //without the index the whole chunk is one window
+    //otherwise index and parse the chunk one window at a time
+    size_t consumed = 0;
+    STATS(counters.chunks++;)
+    if(!indexing){
+        consumed = parseWindow(data);
+        return {isDone(), consumed};
+    }
+    while(consumed < data.length() && !isDone() && !error){
+        std::string_view window = data.substr(consumed, indexWindow);
+        const std::vector<uint32_t> &index = indexer.index(window);
+        windowBegin = window.data();
+        windowEnd = windowBegin + window.length();
+        structural = index.data();
+        structuralEnd = structural + index.size();
+        consumed += parseWindow(window);
+    }
+    return {isDone(), consumed};
+}
+
+bool Parser::parseAll(std::string_view input){
+    reset();
+    borrowing = true;
+    parseContinue(input);
+    finish();
+    borrowing = false;
+    return isValid();
+}
+
+bool Parser::parseFile(const std::string &path){
+    //the old mapping goes with the document that viewed it
+    reset();
+    if(file.open(path))
+        return parseAll(file.view());
+    if(!readBlocks(path, readBlockSize, [&](std::string_view block){ parseContinue(block); }))
+        return false;
+    finish();
+    return isValid();
+}
+
+void Parser::finish(){
+    //whitespace ends a pending root scalar just as more input would
+    parseContinue(" ");
+}
+
+const char *Parser::nextStructural(const char *p){
+    //first indexed position at or after p, or the window end
+    uint32_t offset = p - windowBegin;
+    while(structural != structuralEnd && *structural < offset)
+        structural++;
+    if(structural == structuralEnd)
+        return windowEnd;
+    return windowBegin + *structural;
+}
+
+size_t Parser::parseWindow(std::string_view data){
     //as long as there is data to parse
     //call functions based on State name/currentState()
-    while(data.length()){
+    //return how much of it was parsed
+    size_t size = data.length();
+    while(data.length() && currentState() != State::Done && !error){
         // DEBUG_PRINTF("parsing remaining data, len: %d\n", data.length());
+        STATS(size_t before = data.length(); State counted = currentState();)
         switch(currentState()){
             case State::Start:          parseStart(data); break;
             case State::ObjectOpen:     parseObjectOpen(data); break;
@@ -89,17 +272,26 @@ void Parser::parseContinue(std::string_view data){
             case State::ArrayValue:     parseArrayValue(data); break;
             case State::ArrayComma:     parseArrayComma(data); break;
             case State::String:         parseString(data); break;
+            case State::StringEscape:   parseStringEscape(data); break;
+            case State::StringUnicode:  parseStringUnicode(data); break;
             case State::Number:         parseNumber(data); break;
             case State::TrueStart:      parseTrue(data); break;
             case State::FalseStart:     parseFalse(data); break;
             case State::NullStart:      parseNull(data); break;
+            case State::Skip:           parseSkip(data); break;
             case State::Stop:           parseStop(data); break;
             default: 
             printf("missing case statement for: %s (%d)\n", state_strs[(int)currentState()], int(currentState()));
             assert(false && "Missing case statement for parsing ");
             ;
         }
+        STATS(counters.stateBytes[size_t(counted)] += before - data.length();)
     }
+    STATS(
+        counters.bytes += size - data.length();
+        counters.skippedBytes = counters.stateBytes[size_t(State::Skip)];
+    )
+    return size - data.length();
 }
 
 void Parser::fail(){
@@ -107,23 +299,29 @@ void Parser::fail(){
     error = true;
     pushState(State::Error);
     DEBUG_PRINTF("Error parsing\n");
-    assert(false);
 }
 
 void Parser::consumeWhitespace(std::string_view &data){
     //consume as many WS chars in sequence
-    while(isspace(data[0]) && data.length())
-        data = {data.begin()+1, data.end()};
+    //with the index, everything up to the next entry is WS
+    if(indexing){
+        data = {nextStructural(data.data()), data.data() + data.length()};
+        return;
+    }
+    const char *p = data.data();
+    const char *end = p + data.length();
+    while(p != end && isWhitespace(*p))
+        ++p;
+    data = {p, end};
 }
 
 bool Parser::consumeChar(std::string_view &data, char c){
     //conditional consume char
     //if data[0] == c then consume and return true
     //if not or no chars then return false
-    bool out = data[0] == c;
-    if(!out || !data.length())
+    if(!data.length() || data[0] != c)
         return false;
-    data = {data.begin()+1, data.end()};
+    data.remove_prefix(1);
     return true;
 }
 
@@ -131,10 +329,11 @@ char Parser::consumeChar(std::string_view &data){
     //consume a single char from data
     //return that char
     //if no chars, return '\0'
+    if(!data.length())
+        return 0;
     char c = data[0];
-    if(data.length())
-        return data = {data.begin()+1, data.end()}, c;
-    return 0;
+    data.remove_prefix(1);
+    return c;
 }
 
 void Parser::parseStart(std::string_view &data){
@@ -145,10 +344,12 @@ void Parser::parseStart(std::string_view &data){
     consumeWhitespace(data);
     if(!data.length())
         return;
-    popState(/*Start*/);
-    pushState(State::Stop);
+    setState(State::Stop);
+    rootDropped = false;
+    if(const SelectFilter *s = currentFilter()->select())
+        beginSelection(*s);
     if(!tryParseValue(data))
-        assert(false);
+        fail();
 }
 
 void Parser::parseStop(std::string_view &data){
@@ -158,7 +359,6 @@ void Parser::parseStop(std::string_view &data){
     if(!data.length())
         return;
     fail();
-    assert(false);
 }
 
 void Parser::parseObjectOpen(std::string_view &data){
@@ -171,37 +371,49 @@ void Parser::parseObjectOpen(std::string_view &data){
     popState(/*ObjectOpen*/);
     if(consumeChar(data, '"')){
         DEBUG_PRINTF("parsing ObjectKey (String)\n");
-        pushState(State::ObjectKey);
-        pushState(State::String);
-        token.clear();
+        beginKey(data);
     }else if(consumeChar(data, '}')){
         DEBUG_PRINTF("Empty object {}\n");
-        // DEBUG_PRINTF("branch popping (%d)\n", branch.size());
-        // branch.pop();
+        limits.pop_back();
+        handler->onObjectEnd();
+        endValue();
     }else{
         fail();
     }
 }
 
 void Parser::parseObjectKey(std::string_view &data){
-    // ObjectKey parsed and in token
+    // ObjectKey parsed and in stringValue
     // pop ObjectKey state
     // check nekt char is ':'
-    // then push new FilteredJSON::Value to branch stack
-    // assign to current value (which is an object)
-    // indeked by key (token)
+    // then report the key (stringValue) if the filter keeps it
+    // and push its filter, or skip its value
     consumeWhitespace(data);
     if(!data.length())
         return;
     popState(/*ObjectKey*/);
     if(consumeChar(data, ':')){
         DEBUG_PRINTF("parsing ObjectColon\n");
-        assert(currentValue().isObject());
-        auto &v = currentValue().toObject()[token] = {};
-        branch.push_back(&v);
-        DEBUG_PRINTF("branch pushed (%d) new object elem\n", branch.size());
-        pushState(State::ObjectColon);
-        token.clear();
+        const Filter *f = keyRejected ? nullptr : currentFilter()->keepKey(stringValue);
+        keyRejected = false;
+        if(f){
+            if(limits.back() > 0)
+                limits.back()--;
+            if(const SelectFilter *s = f->select())
+                beginSelection(*s);
+            handler->onKey(stringValue, stringCopied);
+            filters.push_back(f);
+            DEBUG_PRINTF("filter pushed (%d) new object elem\n", filters.size());
+            pushState(State::ObjectColon);
+            token.clear();
+            parseObjectColon(data);
+        }else{
+            DEBUG_PRINTF("skipping object elem\n");
+            filters.push_back(nullptr);
+            pushState(State::ObjectValue);
+            beginSkip();
+            token.clear();
+        }
     }else{
         fail();
     }
@@ -212,9 +424,8 @@ void Parser::parseObjectColon(std::string_view &data){
     consumeWhitespace(data);
     if(!data.length())
         return;
-    popState(/*ObjectColon*/);
     DEBUG_PRINTF("parsing ObjectValue\n");
-    pushState(State::ObjectValue);
+    setState(State::ObjectValue);
     if(tryParseValue(data));
     else{
         fail();
@@ -223,20 +434,23 @@ void Parser::parseObjectColon(std::string_view &data){
 
 void Parser::parseObjectValue(std::string_view &data){
     //pop ObjectValue state
-    //current Object value has been parsed and set in currentValue()
-    //pop current branch FilteredJSON value
+    //current Object value has been parsed and reported
+    //pop its filter
     //check if nekt char is ',' or '}'
     //if ',', push ObjectComma state
     consumeWhitespace(data);
     if(!data.length())
         return;
     popState(/*ObjectValue*/);
-    DEBUG_PRINTF("branch popping (%d) object elem done\n", branch.size());
-    branch.pop_back();
+    DEBUG_PRINTF("filter popping (%d) object elem done\n", filters.size());
+    filters.pop_back();
     if(consumeChar(data, '}')){
-        // popState(/*ObjectOpen*/);
+        limits.pop_back();
+        handler->onObjectEnd();
+        endValue();
     }else if(consumeChar(data, ',')){
         pushState(State::ObjectComma);
+        parseObjectComma(data);
     }else{
         fail();
     }
@@ -252,9 +466,7 @@ void Parser::parseObjectComma(std::string_view &data){
     popState(/*ObjectComma*/);
     if(consumeChar(data, '"')){
         DEBUG_PRINTF("parsing ObjectKey (String)\n");
-        pushState(State::ObjectKey);
-        pushState(State::String);
-        token.clear();
+        beginKey(data);
     }else{
         fail();
     }
@@ -269,44 +481,36 @@ void Parser::parseArrayOpen(std::string_view &data){
         return;
     popState(/*ArrayOpen*/);
     if(consumeChar(data, ']')){
-        // DEBUG_PRINTF("branch popping (%d) array close?\n", branch.size());
-        // branch.pop();
+        arrayIndex.pop_back();
+        limits.pop_back();
+        handler->onArrayEnd();
+        endValue();
     }else{
         pushState(State::ArrayValue);
-        assert(currentValue().isArray());
-        Array & a = currentValue().toArray();
-        Value &v = a.append();
-        branch.push_back(&v);
-        DEBUG_PRINTF("branch pushed (%d) new array elem\n", branch.size());
-        if(tryParseValue(data)){
-            DEBUG_PRINTF("Array got value\n");
-        }else{
-            fail();
-        }
+        beginArrayElement(data);
     }
 }
 
 void Parser::parseArrayValue(std::string_view &data){
     //array value has been parsed
     //pop state
-    //pop current FilteredJSON value (branch)
+    //pop its filter
     //checx if comma 
-    //if comma, push new FilteredJSON value (null) and append to Array
+    //if comma, parse the next element
     consumeWhitespace(data);
     if(!data.length())
         return;
     popState(/*ArrayValue*/);
-    DEBUG_PRINTF("branch popping (%d) array elem done\n", branch.size());
-    branch.pop_back();
+    DEBUG_PRINTF("filter popping (%d) array elem done\n", filters.size());
+    filters.pop_back();
     if(consumeChar(data, ',')){
         pushState(State::ArrayComma);
-        assert(currentValue().isArray());
-        Array & a = currentValue().toArray();
-        Value &v = a.append();
-        branch.push_back(&v);
-        DEBUG_PRINTF("branch pushed (%d) next array elem\n", branch.size());
+        parseArrayComma(data);
     }else if(consumeChar(data, ']')){
-        // popState()
+        arrayIndex.pop_back();
+        limits.pop_back();
+        handler->onArrayEnd();
+        endValue();
     }else{
         fail();
     }
@@ -319,55 +523,305 @@ void Parser::parseArrayComma(std::string_view &data){
     consumeWhitespace(data);
     if(!data.length())
         return;
-    popState(/*ArrayComma*/);
-    pushState(State::ArrayValue);
-    if(!tryParseValue(data)){
-        assert(false);
+    setState(State::ArrayValue);
+    beginArrayElement(data);
+}
+
+void Parser::beginArrayElement(std::string_view &data){
+    //ask the filter whether the next element is kept
+    //if kept, push its filter and parse it
+    //otherwise skip the element without reporting it
+    const Filter *f = currentFilter()->keepIdx(arrayIndex.back()++);
+    if(f){
+        filters.push_back(f);
+        DEBUG_PRINTF("filter pushed (%d) new array elem\n", filters.size());
+        if(const SelectFilter *s = f->select())
+            beginSelection(*s);
+        if(!tryParseValue(data)){
+            fail();
+        }
+    }else{
+        DEBUG_PRINTF("skipping array elem\n");
+        filters.push_back(nullptr);
+        beginSkip();
+    }
+}
+
+void Parser::beginSkip(){
+    //push Skip state for a discarded value, or one passed through
+    //nothing is built until the value ends
+    skipDepth = 0;
+    skipInString = false;
+    skipEscape = false;
+    pushState(State::Skip);
+}
+
+void Parser::parseSkip(std::string_view &data){
+    //only balance brackets and string quotes
+    //the value ends after its closing '"', '}' or ']' at depth 0,
+    //or (for bare scalars) before a ',', '}' or ']' at depth 0
+    //which is left for the enclosing ObjectValue/ArrayValue state
+    const char *begin = data.data();
+    const char *p = begin;
+    const char *end = p + data.length();
+    if(indexing){
+        //only visit structurals, the index already excludes escaped quotes
+        //and structural chars inside strings
+        for(p = nextStructural(p); p != end; p = nextStructural(p + 1)){
+            char c = *p;
+            if(c == '"'){
+                skipInString = !skipInString;
+                if(!skipInString && !skipDepth){
+                    ++p;
+                    popState(/*Skip*/);
+                    break;
+                }
+            }else if(c == '{' || c == '['){
+                ++skipDepth;
+            }else if(c == '}' || c == ']'){
+                if(!skipDepth){
+                    popState(/*Skip*/);
+                    break;
+                }
+                if(!--skipDepth){
+                    ++p;
+                    popState(/*Skip*/);
+                    break;
+                }
+            }else if(c == ',' && !skipDepth){
+                popState(/*Skip*/);
+                break;
+            }
+        }
+        data = {p, end};
+        if(skipCopy)
+            copySkipped(begin, p);
+        return;
     }
+    for(; p != end; ++p){
+        char c = *p;
+        if(skipInString){
+            if(skipEscape)
+                skipEscape = false;
+            else if(c == '\\')
+                skipEscape = true;
+            else if(c == '"'){
+                skipInString = false;
+                if(!skipDepth){
+                    ++p;
+                    popState(/*Skip*/);
+                    break;
+                }
+            }
+            continue;
+        }
+        if(c == '"'){
+            skipInString = true;
+        }else if(c == '{' || c == '['){
+            ++skipDepth;
+        }else if(c == '}' || c == ']'){
+            if(!skipDepth){
+                popState(/*Skip*/);
+                break;
+            }
+            if(!--skipDepth){
+                ++p;
+                popState(/*Skip*/);
+                break;
+            }
+        }else if(c == ',' && !skipDepth){
+            popState(/*Skip*/);
+            break;
+        }
+    }
+    data = {p, end};
+    if(skipCopy)
+        copySkipped(begin, p);
+}
+
+void Parser::copySkipped(const char *begin, const char *end){
+    //write out the part of a passed through value scanned by parseSkip()
+    //once its end is found it counts as a kept value
+    serializer.raw({begin, size_t(end - begin)});
+    if(currentState() == State::Skip)
+        return;
+    skipCopy = false;
+    serializer.endRaw();
+    endValue();
+}
+
+void Parser::beginString(std::string_view &data){
+    //'"' consumed, push String state
+    //when borrowing, nothing is copied to token unless an escape turns up
+    pushState(State::String);
+    token.clear();
+    stringStart = data.data();
+    stringCopied = !borrowing;
+}
+
+void Parser::beginKey(std::string_view &data){
+    //'"' of an object key consumed, push ObjectKey and String states
+    //the key is checked against the filter's prefilter as it is read
+    pushState(State::ObjectKey);
+    beginString(data);
+    keyPrefilter = currentFilter()->keyPrefilter();
+    keyLength = 0;
 }
 
 void Parser::parseString(std::string_view &data){
     //parse string until '"'
-    //handle escape char '\'
-    //put string into tok
-    //once complete, if currentValue().isString() then set it to tok
-    //otherwise leave in tok
-    while(data.length()){
-        if(consumeChar(data, '"')){
-            popState();
-            DEBUG_PRINTF("Got string: ***%s***\n", token.c_str());
-            if(currentValue().isString())
-                currentValue() = String(token);
-            // token.clear();
-            break;
+    //bulk scan for the next '"' or '\', appending the whole run before it to token
+    //escapes are handled by the StringEscape/StringUnicode states
+    //so a chunk may end anywhere inside the string
+    //once complete, set stringValue to token (or the viewed input)
+    //and report it unless it is an object key, see parseObjectKey()
+    const char *p = data.data();
+    const char *end = p + data.length();
+    const char *q;
+    if(indexing){
+        //the next entry inside a string is its closing quote
+        //only the run before it needs searching for '\'
+        q = nextStructural(p);
+        const char *b = (const char*)memchr(p, '\\', q - p);
+        if(b)
+            q = b;
+    }else{
+        q = findQuoteOrBackslash(p, end);
+    }
+    if(keyPrefilter){
+        //a key ruled out by its first byte or its length is only read
+        //to its end, without gathering it
+        if((q != p && !keyLength && !keyPrefilter->mayStartWith(*p))
+            || keyLength + (q - p) > keyPrefilter->maxLength){
+            keyRejected = true;
+            keyPrefilter = nullptr;
         }
-        if(consumeChar(data, '\\')){
-            if(consumeChar(data, '\\'))
-                token += '\\';
-            else if(consumeChar(data, '"'))
-                token += '"';
-            else if(consumeChar(data, '/'))
-                token += '/';
-            else if(consumeChar(data, 'b'))
-                token += '\b';
-            else if(consumeChar(data, 'f'))
-                token += '\f';
-            else if(consumeChar(data, 'n'))
-                token += '\n';
-            else if(consumeChar(data, 'r'))
-                token += '\r';
-            else if(consumeChar(data, 't'))
-                token += '\t';
-            else if(consumeChar(data, 'u')){
-                assert(false &&"Unhandled unicode characters in JSON");
-                int v = std::stoi(std::string{data.begin(), 4}, nullptr, 16);
-                data = {&data[4], data.end()};
-                token += '_';
-            }
+        keyLength += q - p;
+    }
+    if(q != p && stringCopied && !keyRejected){
+        flushSurrogate();
+        token.append(p, q);
+    }
+    if(q == end){
+        data = {end, end};
+        return;
+    }
+    data = {q+1, end};
+    if(*q == '\\'){
+        //escapes change the key's bytes, so the prefilter no longer applies
+        keyPrefilter = nullptr;
+        if(!stringCopied && !keyRejected){
+            //escapes must be decoded, copy what was viewed so far
+            token.assign(stringStart, q);
+            stringCopied = true;
         }
-        // DEBUG_PRINTF("str c '%c'\n", data[0]);
-        token += consumeChar(data);
+        pushState(State::StringEscape);
+        return;
+    }
+    flushSurrogate();
+    popState();
+    keyPrefilter = nullptr;
+    stringValue = stringCopied ? std::string_view{token} : std::string_view{stringStart, q};
+    DEBUG_PRINTF("Got string: ***%.*s***\n", (int)stringValue.size(), stringValue.data());
+    if(currentState() != State::ObjectKey){
+        handler->onString(stringValue, stringCopied);
+        endValue();
+    }else{
+        parseObjectKey(data);
+    }
+}
+
+void Parser::parseStringEscape(std::string_view &data){
+    //char after '\' in a string
+    //pop StringEscape state and append the escaped char
+    //or push StringUnicode state for "\u"
+    char c = consumeChar(data);
+    popState(/*StringEscape*/);
+    if(c == 'u'){
+        unicodeDigits = 0;
+        unicodeValue = 0;
+        pushState(State::StringUnicode);
+        return;
+    }
+    flushSurrogate();
+    switch(c){
+        case '\\':  token += '\\'; break;
+        case '"':   token += '"'; break;
+        case '/':   token += '/'; break;
+        case 'b':   token += '\b'; break;
+        case 'f':   token += '\f'; break;
+        case 'n':   token += '\n'; break;
+        case 'r':   token += '\r'; break;
+        case 't':   token += '\t'; break;
+        default:    fail();
+    }
+}
+
+void Parser::parseStringUnicode(std::string_view &data){
+    //accumulate the 4 hex digits of a "\u" escape
+    //pop StringUnicode state and append the codepoint as UTF-8 once complete
+    while(data.length() && unicodeDigits < 4){
+        char c = consumeChar(data);
+        unsigned d;
+        if(c >= '0' && c <= '9')
+            d = c - '0';
+        else if(c >= 'a' && c <= 'f')
+            d = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')
+            d = c - 'A' + 10;
+        else{
+            fail();
+            return;
+        }
+        unicodeValue = unicodeValue << 4 | d;
+        unicodeDigits++;
     }
+    if(unicodeDigits < 4)
+        return;
+    popState(/*StringUnicode*/);
+    appendCodepoint(unicodeValue);
+}
+
+void Parser::appendCodepoint(unsigned cp){
+    //append cp to token as UTF-8
+    //UTF-16 surrogate pairs arrive as two escapes, hold the high half until the low half
+    if(cp >= 0xD800 && cp <= 0xDBFF){
+        flushSurrogate();
+        highSurrogate = cp;
+        return;
+    }
+    if(cp >= 0xDC00 && cp <= 0xDFFF){
+        if(!highSurrogate){
+            cp = 0xFFFD;
+        }else{
+            cp = 0x10000 + ((highSurrogate - 0xD800) << 10) + (cp - 0xDC00);
+            highSurrogate = 0;
+        }
+    }
+    flushSurrogate();
+    if(cp < 0x80){
+        token += char(cp);
+    }else if(cp < 0x800){
+        token += char(0xC0 | cp >> 6);
+        token += char(0x80 | (cp & 0x3F));
+    }else if(cp < 0x10000){
+        token += char(0xE0 | cp >> 12);
+        token += char(0x80 | (cp >> 6 & 0x3F));
+        token += char(0x80 | (cp & 0x3F));
+    }else{
+        token += char(0xF0 | cp >> 18);
+        token += char(0x80 | (cp >> 12 & 0x3F));
+        token += char(0x80 | (cp >> 6 & 0x3F));
+        token += char(0x80 | (cp & 0x3F));
+    }
+}
+
+void Parser::flushSurrogate(){
+    //a high surrogate not followed by a low one is replaced by U+FFFD
+    if(!highSurrogate)
+        return;
+    highSurrogate = 0;
+    token += "\xEF\xBF\xBD";
 }
 
 bool Parser::tryParseValue(std::string_view &data){
@@ -375,153 +829,332 @@ bool Parser::tryParseValue(std::string_view &data){
     //if none match, return false
     //if match any, return true
     //on match, push state to begin parsing of that type
-    //set the current value to JSON type
+    //report the start of containers, scalars are reported once complete
     //clear token if needed
     if(!data.length())
         return false;
-    if(consumeChar(data, '"')){
-        pushState(State::String);
-        DEBUG_PRINTF("parsing String (set %d)\n", branch.size());
-        currentValue() = String{};
-        token.clear();
-    }else if(consumeChar(data, '{')){
+    if(copyRaw() && (data[0] == '"' || ((data[0] == '{' || data[0] == '[') && currentFilter()->keepsAll()))){
+        //passed through as it is, scanned for its end like a skipped value
+        serializer.beginRaw();
+        beginSkip();
+        skipCopy = true;
+        return true;
+    }
+    switch(data[0]){
+    case '"':
+        data.remove_prefix(1);
+        DEBUG_PRINTF("parsing String\n");
+        beginString(data);
+        break;
+    case '{':
+        if(limits.size() >= maxDepth){
+            fail();
+            break;
+        }
+        data.remove_prefix(1);
         pushState(State::ObjectOpen);
-        DEBUG_PRINTF("parsing Object (set %d)\n", branch.size());
-        currentValue() = Object{};
-    }else if(consumeChar(data, '[')){
+        DEBUG_PRINTF("parsing Object\n");
+        handler->onObjectStart();
+        pushLimit(currentFilter()->keyLimit());
+        break;
+    case '[':
+        if(limits.size() >= maxDepth){
+            fail();
+            break;
+        }
+        data.remove_prefix(1);
         pushState(State::ArrayOpen);
-        DEBUG_PRINTF("parsing Array (set %d)\n", branch.size());
-        currentValue() = Array{};
-    }else if(consumeChar(data, 't')){
-        token = 't';
+        DEBUG_PRINTF("parsing Array\n");
+        arrayIndex.push_back(0);
+        handler->onArrayStart();
+        pushLimit(currentFilter()->indexLimit());
+        break;
+    case 't':
+        token.clear();
         pushState(State::TrueStart);
-        DEBUG_PRINTF("parsing True (set %d)\n", branch.size());
-        currentValue() = Boolean{};
-    }else if(consumeChar(data, 'f')){
-        token = 'f';
+        DEBUG_PRINTF("parsing True\n");
+        parseTrue(data);
+        break;
+    case 'f':
+        token.clear();
         pushState(State::FalseStart);
-        DEBUG_PRINTF("parsing False (set %d)\n", branch.size());
-        currentValue() = Boolean{};
-    }else if(consumeChar(data, 'n')){
-        token = 'n';
+        DEBUG_PRINTF("parsing False\n");
+        parseFalse(data);
+        break;
+    case 'n':
+        token.clear();
         pushState(State::NullStart);
-        DEBUG_PRINTF("parsing Null (set %d)\n", branch.size());
-        currentValue() = {};
-    }else if(data[0] >= '0' && data[0] <= '9' || data[0] == '-'){
+        DEBUG_PRINTF("parsing Null\n");
+        parseNull(data);
+        break;
+    case '-': case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
         pushState(State::Number);
-        DEBUG_PRINTF("parsing Number (set %d)\n", branch.size());
-        token = consumeChar(data);
-        currentValue() = Number{};
-    }else{
+        DEBUG_PRINTF("parsing Number\n");
+        token.clear();
+        numberPart = NumberPart::Start;
+        break;
+    default:
         return false;
     }
     return true;
 }
 
-void Parser::parseNumber(std::string_view &data){
-    //keep accepting chars as long as they match [0-9\.eE]+
-    //otherwise fail()
-    //pop state and set current value (converted from string to int/double as appropriate) on success
-    while(data.length()){
-        if(!(data[0] >= '0' && data[0] <= '9' || data[0] == '.' || data[0] == 'e' || data[0] == 'E')){
-            popState();
-            //check if integer
-            bool isInt = true;
-            for(auto c : token){
-                if(!isdigit(c))
-                    isInt = false;
-            }
-            if(isInt){
-                printf("Parsing nuber: %s\n", token.c_str());
-                currentValue() = Number{std::stoll(token)};
-                DEBUG_PRINTF("Int parsed (set %d)\n", branch.size());
-            }else{
-                auto sv = token.operator std::basic_string_view<char, std::char_traits<char>>();
-                size_t eIdx = token.find_first_of("eE");
-                std::string mantissa;
-                int exp = 0;
-                if(eIdx == -1){
-                    mantissa = token;
-                }
-                else{
-                    mantissa = {sv.begin(), &sv[eIdx]};
-                    std::string exp_str = {&sv[eIdx], sv.end()};
-                    if(exp_str.find_first_of("eE.") != -1)
-                        fail();
-                    printf("Parsing exponent: %s\n", token.c_str());
-                    exp = std::stoi(exp_str);
-
-                }
-                // std::string_view exponent = {token.begin(), eIdx};
-                double d = std::stod(mantissa);
-                d *= std::pow(10, exp);
-                currentValue() = Number{d};
-                DEBUG_PRINTF("Double parsed (set %d)\n", branch.size());
-            }
-            
-            // DEBUG_PRINTF("Number not parsed! (%s)\n", token.c_str());
-            break;
+void Parser::endValue(){
+    //a value has been parsed and its state popped
+    //if it was a selected value, its predicates are decided
+    //if one of them already failed, the selected value is dropped unread
+    //if it was the last one its container can keep, end the container
+    //if it was the root, the document is complete
+    //in multi-document mode hand it over and start the next one
+    STATS(counters.values++;)
+    if(selecting){
+        const OpenSelection &open = selections[selecting - 1];
+        if(limits.size() == open.depth){
+            endSelection();
+        }else if(open.selection->rejected()){
+            endContainer(open.depth);
+            return;
         }
-        token += consumeChar(data);
     }
+    if(currentState() != State::Stop){
+        if(exhausted())
+            endContainer(limits.size() - 1);
+        return;
+    }
+    if(!rootDropped)
+        handler->onDocumentEnd();
+    if(!multiDocument)
+        return;
+    if(handler == &builder){
+        if(documentCallback && !rootDropped)
+            documentCallback(document.root());
+        builder.reset();
+    }
+    popState(/*Stop*/);
+    pushState(State::Start);
 }
 
-void Parser::parseTrue(std::string_view &data){
-    //keep accepting chars as long as they match "true"
-    //otherwise fail()
-    //pop state and set current value on success
-    auto _true = std::string_view{"true"};
-    while(data.length()){
-        if(token == _true){
-            currentValue() = Boolean{true};
-                DEBUG_PRINTF("True parsed (set %d)\n", branch.size());
-            popState(/*TrueStart*/);
-            break;
-        } else if(_true.starts_with(token)) {
-            token += consumeChar(data);
-        }else{
-            assert(false);
-            fail();
+void Parser::pushLimit(int limit){
+    //a container just opened, it may be done before its first value
+    limits.push_back(limit);
+    STATS(counters.maxDepth = std::max(counters.maxDepth, limits.size());)
+    if(exhausted())
+        endContainer(limits.size() - 1);
+}
+
+bool Parser::exhausted() const{
+    //the innermost container can keep no further value
+    int limit = limits.back();
+    if(limit < 0)
+        return false;
+    if(currentState() == State::ArrayOpen || currentState() == State::ArrayValue)
+        return arrayIndex.back() >= limit;
+    return limit == 0;
+}
+
+void Parser::closeLevel(){
+    //end the innermost container as if its closing bracket had been read
+    State s = popState();
+    if(s == State::ObjectValue || s == State::ArrayValue)
+        filters.pop_back();
+    limits.pop_back();
+    if(s == State::ArrayOpen || s == State::ArrayValue){
+        arrayIndex.pop_back();
+        handler->onArrayEnd();
+    }else{
+        handler->onObjectEnd();
+    }
+    if(selecting && limits.size() == selections[selecting - 1].depth)
+        endSelection();
+}
+
+void Parser::endContainer(size_t depth){
+    //end the open containers down to depth and every enclosing one this leaves
+    //exhausted as well, then skip their text up to the last closing bracket
+    //if that ends a single document's root the rest is never read
+    int levels = 0;
+    while(limits.size() > depth || (currentState() != State::Stop && exhausted())){
+        closeLevel();
+        levels++;
+    }
+    //a root ended here is counted by endValue()
+    STATS(counters.values += levels - (currentState() == State::Stop);)
+    if(currentState() == State::Stop){
+        bool last = !multiDocument;
+        endValue();
+        if(last){
+            popState(/*Stop*/);
+            pushState(State::Done);
+            return;
         }
     }
+    beginSkip();
+    skipDepth = levels;
 }
 
-void Parser::parseFalse(std::string_view &data){
-    //keep accepting chars as long as they match "false"
-    //otherwise fail()
-    //pop state and set current value on success
-    auto _false = std::string_view{"false"};
-    while(data.length()){
-        if(token == _false){
-            currentValue() = Boolean{false};
-            DEBUG_PRINTF("False parsed (set %d)\n", branch.size());
-            popState(/*FalseStart*/);
+void Parser::beginSelection(const SelectFilter &filter){
+    //hold back the events of the value about to start, its key included,
+    //until the filter's predicates are decided
+    if(selecting == selections.size())
+        selections.push_back({std::make_unique<Selection>(), 0});
+    OpenSelection &open = selections[selecting++];
+    open.depth = limits.size();
+    open.selection->begin(filter, *handler);
+    handler = open.selection.get();
+}
+
+bool Parser::endSelection(){
+    //the selected value is complete, or closed early
+    OpenSelection &open = selections[--selecting];
+    handler = &open.selection->output();
+    bool kept = open.selection->end();
+    if(!open.depth)
+        rootDropped = !kept;
+    return kept;
+}
+
+void Parser::parseNumber(std::string_view &data){
+    //step the number grammar over the run of chars that can belong to a number
+    //and fail() on the first one out of place, the first char that cannot
+    //belong ends the number. A number within one chunk is converted straight
+    //from the input, one split across chunks is gathered in token.
+    //Passthrough writes the text out instead of converting it
+    const char *begin = data.data();
+    const char *end = begin + data.length();
+    const char *p = begin;
+    for(; p != end; ++p){
+        char c = *p;
+        bool digit = c >= '0' && c <= '9';
+        bool exp = c == 'e' || c == 'E';
+        if(!digit && !exp && c != '.' && c != '-' && c != '+')
             break;
-        } else if(_false.starts_with(token)) {
-            token += consumeChar(data);
-        }else{
-            assert(false);
+        NumberPart next = NumberPart::Start; //Start never follows, so marks an error
+        switch(numberPart){
+            case NumberPart::Start:
+                if(c == '-') next = NumberPart::Sign;
+                [[fallthrough]];
+            case NumberPart::Sign:
+                if(c == '0') next = NumberPart::Zero;
+                else if(digit) next = NumberPart::Int;
+                break;
+            case NumberPart::Int:
+                if(digit) next = NumberPart::Int;
+                [[fallthrough]];
+            case NumberPart::Zero:
+                if(c == '.') next = NumberPart::Dot;
+                else if(exp) next = NumberPart::Exp;
+                break;
+            case NumberPart::Dot:
+            case NumberPart::Frac:
+                if(digit) next = NumberPart::Frac;
+                else if(exp && numberPart == NumberPart::Frac) next = NumberPart::Exp;
+                break;
+            case NumberPart::Exp:
+                if(c == '-' || c == '+') next = NumberPart::ExpSign;
+                [[fallthrough]];
+            case NumberPart::ExpSign:
+            case NumberPart::ExpInt:
+                if(digit) next = NumberPart::ExpInt;
+                break;
+        }
+        if(next == NumberPart::Start){
             fail();
+            return;
         }
+        numberPart = next;
+    }
+    if(p == end){
+        token.append(begin, p);
+        data.remove_prefix(p - begin);
+        return;
+    }
+    if(numberPart != NumberPart::Zero && numberPart != NumberPart::Int
+        && numberPart != NumberPart::Frac && numberPart != NumberPart::ExpInt){
+        fail();
+        return;
     }
+    std::string_view text{begin, size_t(p - begin)};
+    if(!token.empty()){
+        token.append(begin, p);
+        text = token;
+    }
+    if(copyRaw()){
+        serializer.beginRaw();
+        serializer.raw(text);
+        serializer.endRaw();
+    }else{
+        endNumber(text);
+    }
+    data.remove_prefix(p - begin);
+    popState(/*Number*/);
+    endValue();
 }
 
-void Parser::parseNull(std::string_view &data){
-    //keep accepting chars as long as they match "null"
-    //otherwise fail()
-    //pop state and set current value on success
-    auto _null = std::string_view{"null"};
-    while(data.length()){
-        if(token == _null){
-            currentValue() = {};
-            DEBUG_PRINTF("Null parsed (set %d)\n", branch.size());
-            popState(/*NullStart*/);
-            break;
-        } else if(_null.starts_with(token)) {
-            token += consumeChar(data);
-        }else{
-            assert(false);
-            fail();
+void Parser::endNumber(std::string_view text){
+    //integers that fit IntType stay integers, everything else is a double
+    const char *first = text.data();
+    const char *last = first + text.length();
+    if(numberPart == NumberPart::Zero || numberPart == NumberPart::Int){
+        Number::IntType i;
+        if(std::from_chars(first, last, i).ec == std::errc{}){
+            if(i == 0 && *first == '-')
+                handler->onNumber(Number{-0.0});
+            else
+                handler->onNumber(Number{i});
+            DEBUG_PRINTF("Int parsed\n");
+            return;
         }
     }
-}
\ No newline at end of file
+    double d;
+    if(std::from_chars(first, last, d).ec == std::errc::result_out_of_range){
+        //from_chars leaves d alone, strtod rounds to inf or zero
+        d = std::strtod(std::string{text}.c_str(), nullptr);
+    }
+    handler->onNumber(Number{d});
+    DEBUG_PRINTF("Double parsed\n");
+}
+
+bool Parser::parseLiteral(std::string_view &data, std::string_view word){
+    //accept as much of word as data holds, token holds what came before
+    //fail() on a mismatch
+    //return true once the whole word is read
+    size_t n = std::min(word.length() - token.length(), data.length());
+    if(data.substr(0, n) != word.substr(token.length(), n)){
+        fail();
+        return false;
+    }
+    token.append(data.data(), n);
+    data.remove_prefix(n);
+    return token.length() == word.length();
+}
+
+void Parser::parseTrue(std::string_view &data){
+    //pop state and report the value once "true" is read
+    if(!parseLiteral(data, "true"))
+        return;
+    handler->onBoolean(true);
+    DEBUG_PRINTF("True parsed\n");
+    popState(/*TrueStart*/);
+    endValue();
+}
+
+void Parser::parseFalse(std::string_view &data){
+    //pop state and report the value once "false" is read
+    if(!parseLiteral(data, "false"))
+        return;
+    handler->onBoolean(false);
+    DEBUG_PRINTF("False parsed\n");
+    popState(/*FalseStart*/);
+    endValue();
+}
+
+void Parser::parseNull(std::string_view &data){
+    //pop state and report the value once "null" is read
+    if(!parseLiteral(data, "null"))
+        return;
+    handler->onNull();
+    DEBUG_PRINTF("Null parsed\n");
+    popState(/*NullStart*/);
+    endValue();
+}
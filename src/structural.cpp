@@ -0,0 +1,179 @@
+#include "filteredjson/structural.hpp"
+
+#include <bit>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FILTEREDJSON_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace FilteredJSON;
+
+static StructuralIndexer::Masks classifyScalar(const char *block){
+    StructuralIndexer::Masks m{};
+    for(int i = 0; i < 64; i++){
+        uint64_t bit = 1ull << i;
+        switch(block[i]){
+            case '"':   m.quote |= bit; break;
+            case '\\':  m.backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                        m.structural |= bit; break;
+            case ' ': case '\t': case '\n': case '\r':
+                        m.whitespace |= bit; break;
+        }
+    }
+    return m;
+}
+
+#ifdef FILTEREDJSON_X86
+__attribute__((target("sse4.2")))
+static inline uint64_t eq16(__m128i v, char c){
+    return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+__attribute__((target("sse4.2")))
+static StructuralIndexer::Masks classifySSE42(const char *block){
+    StructuralIndexer::Masks m{};
+    for(int i = 0; i < 4; i++){
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + i*16));
+        int shift = i*16;
+        m.quote |= eq16(v, '"') << shift;
+        m.backslash |= eq16(v, '\\') << shift;
+        m.structural |= (eq16(v, '{') | eq16(v, '}') | eq16(v, '[') | eq16(v, ']') | eq16(v, ':') | eq16(v, ',')) << shift;
+        m.whitespace |= (eq16(v, ' ') | eq16(v, '\t') | eq16(v, '\n') | eq16(v, '\r')) << shift;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t eq32(__m256i v, char c){
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+__attribute__((target("avx2")))
+static StructuralIndexer::Masks classifyAVX2(const char *block){
+    StructuralIndexer::Masks m{};
+    for(int i = 0; i < 2; i++){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(block + i*32));
+        int shift = i*32;
+        m.quote |= eq32(v, '"') << shift;
+        m.backslash |= eq32(v, '\\') << shift;
+        m.structural |= (eq32(v, '{') | eq32(v, '}') | eq32(v, '[') | eq32(v, ']') | eq32(v, ':') | eq32(v, ',')) << shift;
+        m.whitespace |= (eq32(v, ' ') | eq32(v, '\t') | eq32(v, '\n') | eq32(v, '\r')) << shift;
+    }
+    return m;
+}
+#endif
+
+bool StructuralIndexer::isSupported(Kernel kernel){
+    switch(kernel){
+        case Kernel::Auto:
+        case Kernel::Scalar:
+            return true;
+#ifdef FILTEREDJSON_X86
+        case Kernel::SSE42:
+            return __builtin_cpu_supports("sse4.2");
+        case Kernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+StructuralIndexer::StructuralIndexer(Kernel kernel){
+    if(kernel == Kernel::Auto){
+        if(isSupported(Kernel::AVX2))
+            kernel = Kernel::AVX2;
+        else if(isSupported(Kernel::SSE42))
+            kernel = Kernel::SSE42;
+        else
+            kernel = Kernel::Scalar;
+    }
+    if(!isSupported(kernel))
+        kernel = Kernel::Scalar;
+    m_kernel = kernel;
+    switch(kernel){
+#ifdef FILTEREDJSON_X86
+        case Kernel::AVX2:  m_classify = classifyAVX2; break;
+        case Kernel::SSE42: m_classify = classifySSE42; break;
+#endif
+        default:            m_classify = classifyScalar; break;
+    }
+    reset();
+}
+
+void StructuralIndexer::reset(){
+    m_escapeCarry = false;
+    m_stringCarry = false;
+    m_scalarCarry = false;
+    m_positions.clear();
+}
+
+const std::vector<uint32_t> &StructuralIndexer::index(std::string_view chunk){
+    //positions are relative to the start of chunk
+    //the last partial block is padded with whitespace
+    m_positions.clear();
+    const char *p = chunk.data();
+    size_t len = chunk.length();
+    size_t offset = 0;
+    for(; len - offset >= 64; offset += 64)
+        indexBlock(p + offset, 64, offset);
+    if(offset != len){
+        char block[64];
+        memset(block, ' ', sizeof(block));
+        memcpy(block, p + offset, len - offset);
+        indexBlock(block, len - offset, offset);
+    }
+    return m_positions;
+}
+
+void StructuralIndexer::indexBlock(const char *block, int len, uint32_t offset){
+    Masks m = m_classify(block);
+    uint64_t valid = len == 64 ? ~0ull : (1ull << len) - 1;
+
+    //chars escaped by a backslash, walked one backslash at a time since they are rare
+    uint64_t escaped = 0;
+    uint64_t backslash = m.backslash & valid;
+    if(m_escapeCarry){
+        escaped |= 1;
+        backslash &= ~1ull;
+    }
+    m_escapeCarry = false;
+    while(backslash){
+        int i = std::countr_zero(backslash);
+        backslash &= ~(1ull << i);
+        if(i + 1 == len){
+            m_escapeCarry = true;
+            break;
+        }
+        escaped |= 1ull << (i + 1);
+        backslash &= ~(1ull << (i + 1));
+    }
+
+    //prefix xor of the real quotes marks the bytes inside strings
+    //(opening quote included, closing quote excluded)
+    uint64_t quote = m.quote & ~escaped & valid;
+    uint64_t inString = quote;
+    inString ^= inString << 1;
+    inString ^= inString << 2;
+    inString ^= inString << 4;
+    inString ^= inString << 8;
+    inString ^= inString << 16;
+    inString ^= inString << 32;
+    if(m_stringCarry)
+        inString = ~inString;
+    m_stringCarry = (inString >> (len - 1)) & 1;
+
+    //first byte of every bare token (number, true, false, null or garbage)
+    uint64_t scalar = ~(m.structural | m.whitespace | quote) & ~inString & valid;
+    uint64_t scalarStart = scalar & ~(scalar << 1 | (m_scalarCarry ? 1 : 0));
+    m_scalarCarry = (scalar >> (len - 1)) & 1;
+
+    uint64_t entries = (m.structural & ~inString & valid) | quote | scalarStart;
+    while(entries){
+        m_positions.push_back(offset + std::countr_zero(entries));
+        entries &= entries - 1;
+    }
+}
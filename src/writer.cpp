@@ -0,0 +1,77 @@
+#include "filteredjson/writer.hpp"
+
+#include <algorithm>
+
+using namespace FilteredJSON;
+
+void Writer::writeSlow(std::string_view s){
+    //copy what fits, make room, repeat
+    while(s.size()){
+        if(m_pos == m_end)
+            overflow(s.size());
+        size_t n = std::min(s.size(), size_t(m_end - m_pos));
+        memcpy(m_pos, s.data(), n);
+        m_pos += n;
+        s.remove_prefix(n);
+    }
+}
+
+BufferWriter::BufferWriter(size_t reserve){
+    m_out.resize(std::max<size_t>(reserve, 16));
+    m_begin = m_pos = m_out.data();
+    m_end = m_begin + m_out.size();
+}
+
+void BufferWriter::overflow(size_t need){
+    size_t used = m_pos - m_begin;
+    m_out.resize(std::max(m_out.size() * 2, used + need));
+    m_begin = m_out.data();
+    m_pos = m_begin + used;
+    m_end = m_begin + m_out.size();
+}
+
+std::string BufferWriter::take(){
+    m_out.resize(m_pos - m_begin);
+    std::string out = std::move(m_out);
+    m_out.resize(16);
+    m_begin = m_pos = m_out.data();
+    m_end = m_begin + m_out.size();
+    return out;
+}
+
+StreamWriter::StreamWriter(std::ostream &out, size_t bufferSize) : m_out{out}, m_buffer(std::max<size_t>(bufferSize, 16)) {
+    m_begin = m_pos = m_buffer.data();
+    m_end = m_begin + m_buffer.size();
+}
+
+StreamWriter::~StreamWriter(){
+    flush();
+}
+
+void StreamWriter::flush(){
+    m_out.write(m_begin, m_pos - m_begin);
+    m_pos = m_begin;
+}
+
+void StreamWriter::overflow(size_t){
+    flush();
+}
+
+CallbackWriter::CallbackWriter(Callback callback, size_t chunkSize) : m_callback{std::move(callback)}, m_buffer(std::max<size_t>(chunkSize, 16)) {
+    m_begin = m_pos = m_buffer.data();
+    m_end = m_begin + m_buffer.size();
+}
+
+CallbackWriter::~CallbackWriter(){
+    flush();
+}
+
+void CallbackWriter::flush(){
+    if(m_pos != m_begin)
+        m_callback({m_begin, size_t(m_pos - m_begin)});
+    m_pos = m_begin;
+}
+
+void CallbackWriter::overflow(size_t){
+    flush();
+}
@@ -0,0 +1,1148 @@
+#include <gtest/gtest.h>
+
+#include "filteredjson/fanout.hpp"
+#include "filteredjson/filter.hpp"
+#include "filteredjson/lazy.hpp"
+#include "filteredjson/parallel.hpp"
+#include "filteredjson/parser.hpp"
+#include "filteredjson/static_filter.hpp"
+#include "filteredjson/structural.hpp"
+#include "filteredjson/writer.hpp"
+
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+// files are memory mapped and FIFOs exist where the library maps them, see src/file.cpp
+#if __has_include(<sys/mman.h>)
+#define POSIX_FILES 1
+#include <sys/stat.h>
+#else
+#define POSIX_FILES 0
+#endif
+
+using namespace FilteredJSON;
+
+namespace
+{
+  // feed the input one byte at a time so every state has to resume mid-token
+  void parseBytewise(Parser &parser, std::string_view input)
+  {
+    for (size_t i = 0; i < input.size(); i++)
+      parser.parseContinue(input.substr(i, 1));
+  }
+} // namespace
+
+TEST(Parser, ParsesWholeDocument)
+{
+  Parser parser;
+  parser.parseContinue(R"({"a": [1, 2.5, "x"], "b": {"c": true, "d": null}})");
+  ASSERT_TRUE(parser.isValid());
+  Value &root = parser.getValue();
+  ASSERT_TRUE(root.isObject());
+  EXPECT_EQ(root.toObject()["a"].toArray()[1].toNumber().asDouble(), 2.5);
+  EXPECT_EQ(root.toObject()["a"].toArray()[2].toString().getValue(), "x");
+  EXPECT_TRUE(root.toObject()["b"].toObject()["c"].toBoolean());
+  EXPECT_TRUE(root.toObject()["b"].toObject()["d"].isNull());
+}
+
+TEST(ParserFilter, SkipsRejectedKeys)
+{
+  ObjectFilter filter;
+  filter.add("keep", std::make_unique<Identity>());
+  Parser parser{filter};
+  parser.parseContinue(R"({"drop": {"x": [1, "]}", {"y": "\"}"}]}, "keep": {"z": 3}, "tail": 12 })");
+  ASSERT_TRUE(parser.isValid());
+  const Object &root = parser.getValue().toObject();
+  EXPECT_EQ(root.size(), 1u);
+  EXPECT_EQ(root["keep"].stringify(-1), R"({"z":3})");
+}
+
+TEST(ParserFilter, NestedPathsAndIndices)
+{
+  auto items = std::make_unique<ObjectFilter>();
+  items->add("id", std::make_unique<Identity>());
+  ArrayFilter tags;
+  tags.add(1, std::make_unique<Identity>());
+  ObjectFilter filter;
+  filter.add("items", std::make_unique<Collector>(std::move(items)));
+  filter.add("tags", std::make_unique<ArrayFilter>(std::move(tags)));
+  Parser parser{filter};
+  parseBytewise(parser, R"({"items": [{"id": 1, "name": "a"}, {"name": "b", "id": 2}],
+    "tags": ["t0", "t1", "t2"], "other": [true, false]})");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"items":[{"id":1},{"id":2}],"tags":["t1"]})");
+}
+
+TEST(ParserFilter, SkipsScalarsAndEmptyContainers)
+{
+  ObjectFilter filter;
+  filter.add("b", std::make_unique<Identity>());
+  Parser parser{filter};
+  parseBytewise(parser, R"({"a": 10 , "s": "x,}", "e": {}, "f": [], "b": [] , "n": null})");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"b":[]})");
+}
+
+TEST(ParserFilter, SetFilterResetsParser)
+{
+  Parser parser;
+  ArrayFilter filter;
+  filter.add(0, std::make_unique<Identity>());
+  parser.setFilter(&filter);
+  parser.parseContinue(R"([{"a": 1}, {"b": 2}])");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"([{"a":1}])");
+  parser.setFilter(nullptr);
+  parser.parseContinue(R"([{"a": 1}, {"b": 2}])");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"([{"a":1},{"b":2}])");
+}
+
+namespace
+{
+  std::string parseFiltered(const Filter &filter, std::string_view input)
+  {
+    Parser parser{filter};
+    parser.parseContinue(input);
+    EXPECT_TRUE(parser.isValid());
+    return parser.getValue().stringify(-1);
+  }
+
+  constexpr std::string_view doc = R"({"a": {"b": 1, "c": 2, "d": 3}, "items": [{"id": 1, "x": 2}, {"id": 3, "x": 4}, {"id": 5, "x": 6}], "e f": true, "z": null})";
+} // namespace
+
+TEST(FilterCompiler, Paths)
+{
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".a.b"), doc), R"({"a":{"b":1}})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".items[].id"), doc), R"({"items":[{"id":1},{"id":3},{"id":5}]})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".items[1]"), doc), R"({"items":[{"id":3,"x":4}]})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string(R"(."e f", .["z"])"), doc), R"({"e f":true,"z":null})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string("."), doc), parseFiltered(Identity{}, doc));
+}
+
+TEST(FilterCompiler, UnionsMergePrefixes)
+{
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".a.b, .a.c, .a.b"), doc), R"({"a":{"b":1,"c":2}})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".a.b, .a"), doc), R"({"a":{"b":1,"c":2,"d":3}})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string(".items[].id, .items[2].x"), doc),
+            R"({"items":[{"id":1},{"id":3},{"id":5,"x":6}]})");
+  EXPECT_EQ(parseFiltered(*Filter::from_strings({".a.d", ".items[0] | .x", "{z}"}), doc),
+            R"({"a":{"d":3},"items":[{"x":2}],"z":null})");
+}
+
+TEST(FilterCompiler, Projections)
+{
+  EXPECT_EQ(parseFiltered(*Filter::from_string("{z, a: .c, items: .[] | {id}}"), doc),
+            R"({"a":{"c":2},"items":[{"id":1},{"id":3},{"id":5}],"z":null})");
+  EXPECT_EQ(parseFiltered(*Filter::from_string("(.a, .items[0]) | (.b, .id)"), doc),
+            R"({"a":{"b":1},"items":[{"id":1}]})");
+}
+
+TEST(FilterCompiler, RejectsMalformed)
+{
+  EXPECT_EQ(Filter::from_string(""), nullptr);
+  EXPECT_EQ(Filter::from_string(".a."), nullptr);
+  EXPECT_EQ(Filter::from_string(".a[x]"), nullptr);
+  EXPECT_EQ(Filter::from_string("{a: }"), nullptr);
+  EXPECT_EQ(Filter::from_string(".a | "), nullptr);
+  EXPECT_EQ(Filter::from_strings({".a", ".b["}), nullptr);
+}
+
+TEST(ParserString, EscapesAcrossChunks)
+{
+  constexpr std::string_view input = R"(["plain text longer than one block", "a\"b\\c\/d\n\t", "\u00e9\u20AC\ud83d\ude00", "\udc00x\ud800"])";
+  for (size_t chunk : {1, 2, 3, 5, 8, 64})
+  {
+    Parser parser;
+    for (size_t i = 0; i < input.size(); i += chunk)
+      parser.parseContinue(input.substr(i, chunk));
+    ASSERT_TRUE(parser.isValid());
+    const Array &a = parser.getValue().toArray();
+    EXPECT_EQ(a[0].toString().getValue(), "plain text longer than one block");
+    EXPECT_EQ(a[1].toString().getValue(), "a\"b\\c/d\n\t");
+    EXPECT_EQ(a[2].toString().getValue(), "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80");
+    EXPECT_EQ(a[3].toString().getValue(), "\xEF\xBF\xBDx\xEF\xBF\xBD");
+  }
+}
+
+TEST(StructuralIndex, KernelsAgreeAcrossChunks)
+{
+  std::string input = R"({"a\\": "x\"{[,", "b" : [ 1, -2.5e3 , true,null ], "\\\\\"": {}})";
+  while (input.size() < 300)
+    input += " " + input;
+  std::vector<uint32_t> expected;
+  StructuralIndexer scalar{StructuralIndexer::Kernel::Scalar};
+  expected = scalar.index(input);
+  EXPECT_EQ(input[expected[0]], '{');
+  EXPECT_EQ(input[expected[1]], '"');
+  EXPECT_EQ(input[expected[2]], '"');
+  EXPECT_EQ(input[expected[3]], ':');
+  for (auto kernel : {StructuralIndexer::Kernel::Scalar, StructuralIndexer::Kernel::SSE42, StructuralIndexer::Kernel::AVX2})
+  {
+    if (!StructuralIndexer::isSupported(kernel))
+      continue;
+    for (size_t chunk : {1, 7, 63, 64, 65, 100})
+    {
+      StructuralIndexer indexer{kernel};
+      std::vector<uint32_t> got;
+      for (size_t i = 0; i < input.size(); i += chunk)
+      {
+        for (auto pos : indexer.index(std::string_view{input}.substr(i, chunk)))
+          got.push_back(pos + i);
+      }
+      EXPECT_EQ(got, expected) << "kernel " << int(kernel) << " chunk " << chunk;
+    }
+  }
+}
+
+TEST(StructuralIndex, ParserMatchesByteParser)
+{
+  std::string input = R"({"items": [{"id": 1, "s": "a\"}\\", "n": {"x": [1, {"y": "]"}]}}, {"id": 2, "s": "\u00e9"}], "t": [true, false, null], "z": "end"})";
+  auto filter = Filter::from_string(".items[].s, .t[1], .z");
+  for (const Filter *f : std::initializer_list<const Filter *>{nullptr, filter.get()})
+  {
+    Parser reference;
+    reference.setFilter(f);
+    reference.parseContinue(input);
+    ASSERT_TRUE(reference.isValid());
+    for (size_t chunk : {1, 3, 16, 1000})
+    {
+      Parser parser;
+      parser.setFilter(f);
+      parser.useStructuralIndex(true);
+      for (size_t i = 0; i < input.size(); i += chunk)
+        parser.parseContinue(std::string_view{input}.substr(i, chunk));
+      ASSERT_TRUE(parser.isValid());
+      EXPECT_EQ(parser.getValue().stringify(-1), reference.getValue().stringify(-1));
+    }
+  }
+}
+
+TEST(Value, CompactLayout)
+{
+  EXPECT_EQ(sizeof(Value), 16u);
+}
+
+TEST(Value, CopyMoveAndReassign)
+{
+  Value v{Object{}};
+  v.toObject()["s"] = String{std::string{"text"}};
+  v.toObject()["n"] = Number{2.5};
+  v.toObject()["i"] = Number{7};
+  v.toObject()["a"] = Array{};
+  v.toObject()["a"].toArray().append(Boolean{true});
+
+  Value copy{v};
+  Value moved{std::move(v)};
+  EXPECT_TRUE(v.isNull());
+  EXPECT_EQ(copy.stringify(-1), moved.stringify(-1));
+  EXPECT_TRUE(copy.toObject()["i"].toNumber().isInteger());
+  EXPECT_EQ(copy.toObject()["i"].toNumber().asInteger(), 7);
+  EXPECT_EQ(copy.toObject()["n"].toNumber().asDouble(), 2.5);
+  EXPECT_TRUE(copy.toObject()["a"].toArray()[0].toBoolean());
+
+  copy.toObject()["s"] = Number{1};
+  copy = copy.toObject()["a"];
+  EXPECT_EQ(copy.stringify(-1), "[true]");
+  copy = copy;
+  EXPECT_EQ(copy.stringify(-1), "[true]");
+}
+
+TEST(Document, ArenaOwnsParsedTree)
+{
+  Parser parser;
+  std::string input = R"({"a": [1, "a string longer than the small string buffer", {"b": "c"}]})";
+  parser.parseContinue(input);
+  ASSERT_TRUE(parser.isValid());
+  Value copy{parser.getValue()};
+  size_t capacity = parser.getDocument().capacity();
+  for (int i = 0; i < 3; i++)
+  {
+    parser.reset();
+    parser.parseContinue(input);
+    ASSERT_TRUE(parser.isValid());
+  }
+  EXPECT_EQ(parser.getDocument().capacity(), capacity);
+  EXPECT_EQ(copy.stringify(-1), parser.getValue().stringify(-1));
+}
+
+TEST(Document, CopiesIntoTheTreeStayInTheArena)
+{
+  Parser source;
+  ASSERT_TRUE(source.parseAll(R"(["a string longer than the small string buffer", {"k": "v"}, [true]])"));
+  Value heap{source.getValue()};
+  Parser parser;
+  ASSERT_TRUE(parser.parseAll(R"(["x", [1], 2])"));
+  Allocator arena = parser.getDocument().allocator();
+  Array &root = parser.getValue().toArray();
+  // replacing a string or container keeps its allocator
+  root[0] = heap;
+  root[1] = heap.toArray()[1];
+  EXPECT_EQ(root[0].toArray().get_allocator(), arena);
+  EXPECT_EQ(root[1].toObject().get_allocator(), arena);
+  // a scalar has none, the copy is made with the arena's
+  root[2] = Value{heap.toArray()[2], arena};
+  EXPECT_EQ(root[2].toArray().get_allocator(), arena);
+  EXPECT_EQ(parser.getValue().stringify(-1), R"([["a string longer than the small string buffer",{"k":"v"},[true]],{"k":"v"},[true]])");
+  // clear() then leaves nothing behind, which LeakSanitizer checks
+  parser.reset();
+}
+
+TEST(Document, GrowsFirstBufferToFit)
+{
+  Document doc{64};
+  doc.root() = Array{doc.allocator()};
+  for (int i = 0; i < 100; i++)
+    doc.root().toArray().append(String{"some text that does not fit inline", doc.allocator()});
+  doc.clear();
+  EXPECT_TRUE(doc.root().isNull());
+  EXPECT_GT(doc.capacity(), 64u);
+}
+
+TEST(ParserZeroCopy, UnescapedStringsViewInput)
+{
+  std::string input = R"({"plain": "value", "esc\"aped": "line\nbreak", "list": ["x", "yé"]})";
+  for (bool index : {false, true})
+  {
+    Parser parser;
+    parser.useStructuralIndex(index);
+    ASSERT_TRUE(parser.parseAll(input));
+    auto inInput = [&](std::string_view s)
+    { return s.data() >= input.data() && s.data() + s.size() <= input.data() + input.size(); };
+    const Object &root = parser.getValue().toObject();
+    for (auto &[k, v] : root)
+    {
+      std::string_view key = k;
+      EXPECT_EQ(k.isView(), key != "esc\"aped") << key;
+      EXPECT_EQ(inInput(key), k.isView()) << key;
+    }
+    const String &plain = root["plain"].toString();
+    EXPECT_TRUE(plain.isView());
+    EXPECT_TRUE(inInput(plain));
+    EXPECT_FALSE(root["esc\"aped"].toString().isView());
+    EXPECT_EQ(root["esc\"aped"].toString().getValue(), "line\nbreak");
+    EXPECT_TRUE(root["list"].toArray()[0].toString().isView());
+    EXPECT_EQ(root["list"].toArray()[1].toString().getValue(), "y\xC3\xA9");
+
+    Value copy{parser.getValue()};
+    EXPECT_FALSE(copy.toObject()["plain"].toString().isView());
+    EXPECT_EQ(copy.stringify(-1), parser.getValue().stringify(-1));
+  }
+}
+
+TEST(Object, KeepsInsertionOrder)
+{
+  Parser parser;
+  parser.parseContinue(R"({"z": 1, "a": 2, "m": 3, "a": 4})");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"z":1,"a":4,"m":3})");
+}
+
+TEST(Object, IndexedLookupOnLargeObjects)
+{
+  Object o;
+  for (int i = 0; i < 100; i++)
+    o[std::to_string(i)] = Number{i};
+  EXPECT_EQ(o.size(), 100u);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(o[std::to_string(i)].toNumber().asInteger(), i);
+  o["100"] = Number{100};
+  EXPECT_TRUE(o.contains("100"));
+  EXPECT_FALSE(o.contains("101"));
+  EXPECT_EQ(o.find("101"), o.end());
+  EXPECT_EQ(o.find("50")->second.toNumber().asInteger(), 50);
+  EXPECT_EQ((o.end() - 1)->first.getValue(), "100");
+
+  Object copy{o};
+  EXPECT_EQ(copy["99"].toNumber().asInteger(), 99);
+  Object assigned;
+  assigned = copy;
+  EXPECT_EQ(assigned.find("42")->second.toNumber().asInteger(), 42);
+}
+
+TEST(Object, ConstLookupsFromManyThreads)
+{
+  // a finished tree is only read, which ThreadSanitizer checks
+  Parser parser;
+  std::string input = "{";
+  for (int i = 0; i < 200; i++)
+    input += (i ? ", \"" : "\"") + std::to_string(i) + "\": " + std::to_string(i);
+  input += "}";
+  ASSERT_TRUE(parser.parseAll(input));
+  // copies included, they are indexed before any lookup
+  Value copy{parser.getValue()};
+  const Object &o = copy.toObject();
+  std::vector<std::thread> readers;
+  std::atomic<int> found{0};
+  for (int t = 0; t < 4; t++)
+    readers.emplace_back([&] {
+      for (int i = 0; i < 200; i++)
+        found += o.contains(std::to_string(i));
+    });
+  for (std::thread &reader : readers)
+    reader.join();
+  EXPECT_EQ(found, 800);
+}
+
+TEST(Writer, CompactPrettyAndEscaped)
+{
+  Parser parser;
+  parser.parseContinue(R"({"s": "q\"b\\n\n\u0001", "a": [1, [], {}], "o": {"t": true}})");
+  ASSERT_TRUE(parser.isValid());
+  const Value &v = parser.getValue();
+  EXPECT_EQ(v.stringify(-1), R"({"s":"q\"b\\n\n\u0001","a":[1,[],{}],"o":{"t":true}})");
+  EXPECT_EQ(v.stringify(0), "{\n  \"s\": \"q\\\"b\\\\n\\n\\u0001\",\n  \"a\": [\n    1,\n    [],\n    {}\n  ],\n  \"o\": {\n    \"t\": true\n  }\n}");
+
+  std::ostringstream os;
+  {
+    StreamWriter out{os, 16};
+    v.serialize(out);
+  }
+  EXPECT_EQ(os.str(), v.stringify(-1));
+
+  std::vector<std::string> chunks;
+  CallbackWriter out{[&](std::string_view s)
+                     { chunks.emplace_back(s); },
+                     16};
+  v.serialize(out, 2);
+  out.flush();
+  std::string joined;
+  for (auto &c : chunks)
+  {
+    EXPECT_LE(c.size(), 16u);
+    joined += c;
+  }
+  EXPECT_EQ(joined, v.stringify(2));
+}
+
+TEST(Number, ExactRoundTrip)
+{
+  // every number must print as text that parses back to the identical value
+  for (std::string_view text : {"0", "-1", "9223372036854775807", "-9223372036854775808", "0.1", "-2.5",
+                                "1e+300", "5e-324", "1.7976931348623157e+308", "2.2250738585072014e-308",
+                                "0.30000000000000004", "123456.789", "1e+21", "2.0", "-0.0"})
+  {
+    Parser parser;
+    ASSERT_TRUE(parser.parseAll(text)) << text;
+    std::string printed = parser.getValue().stringify(-1);
+    Parser reparsed;
+    ASSERT_TRUE(reparsed.parseAll(printed)) << printed;
+    Number a = parser.getValue().toNumber(), b = reparsed.getValue().toNumber();
+    ASSERT_EQ(a.isInteger(), b.isInteger()) << text << " -> " << printed;
+    if (a.isInteger())
+      EXPECT_EQ(a.asInteger(), b.asInteger()) << text;
+    else
+      EXPECT_EQ(std::bit_cast<uint64_t>(a.asDouble()), std::bit_cast<uint64_t>(b.asDouble())) << text << " -> " << printed;
+  }
+}
+
+TEST(Number, GrammarAcrossChunks)
+{
+  Parser parser;
+  parseBytewise(parser, R"([0, -0, 12, 1.5E+2, -3e-2, 4E2, 9223372036854775808, 1e400, 0.0])");
+  ASSERT_TRUE(parser.isValid());
+  const Array &a = parser.getValue().toArray();
+  EXPECT_EQ(a[0].toNumber().asInteger(), 0);
+  EXPECT_TRUE(std::signbit(a[1].toNumber().asDouble()));
+  EXPECT_EQ(a[2].toNumber().asInteger(), 12);
+  EXPECT_EQ(a[3].toNumber().asDouble(), 150.0);
+  EXPECT_EQ(a[4].toNumber().asDouble(), -0.03);
+  EXPECT_EQ(a[5].toNumber().asDouble(), 400.0);
+  EXPECT_EQ(a[6].toNumber().asDouble(), 9223372036854775808.0);
+  EXPECT_TRUE(std::isinf(a[7].toNumber().asDouble()));
+  EXPECT_EQ(a[8].toNumber().asDouble(), 0.0);
+  EXPECT_EQ(parser.getValue().stringify(-1), "[0,-0.0,12,150.0,-0.03,400.0,9223372036854775808.0,null,0.0]");
+
+  // a root scalar only completes once finish() marks the end of the input
+  Parser root;
+  parseBytewise(root, "-12.5e1");
+  root.finish();
+  ASSERT_TRUE(root.isValid());
+  EXPECT_EQ(root.getValue().toNumber().asDouble(), -125.0);
+}
+
+namespace
+{
+  // records the events as a compact trace
+  struct TraceHandler : Handler
+  {
+    std::string trace;
+    void onObjectStart() override { trace += '{'; }
+    void onKey(std::string_view key, bool) override { trace.append(key).append(":"); }
+    void onObjectEnd() override { trace += '}'; }
+    void onArrayStart() override { trace += '['; }
+    void onArrayEnd() override { trace += ']'; }
+    void onString(std::string_view value, bool) override { trace.append("'").append(value).append("' "); }
+    void onNumber(Number value) override { trace.append(value.stringify(-1)).append(" "); }
+    void onBoolean(bool value) override { trace += value ? "T " : "F "; }
+    void onNull() override { trace += "N "; }
+  };
+} // namespace
+
+TEST(Handler, ReportsEventsInDocumentOrder)
+{
+  TraceHandler handler;
+  Parser parser{handler};
+  parseBytewise(parser, R"({"a": [1, 2.5, "x\n"], "b": {"c": true, "d": null}, "e": [], "f": {}, "g": false})");
+  ASSERT_TRUE(parser.isValid());
+  EXPECT_EQ(handler.trace, "{a:[1 2.5 'x\n' ]b:{c:T d:N }e:[]f:{}g:F }");
+}
+
+TEST(Handler, FilteredValuesRaiseNoEvents)
+{
+  auto filter = Filter::from_string(".items[].id, .meta");
+  ASSERT_TRUE(filter);
+  TraceHandler handler;
+  Parser parser{handler, *filter};
+  EXPECT_TRUE(parser.parseAll(R"({"items": [{"id": 1, "name": "a"}, {"name": "b", "id": 2}], "meta": "m", "x": [1, {}]})"));
+  EXPECT_EQ(handler.trace, "{items:[{id:1 }{id:2 }]meta:'m' }");
+
+  // switching back to the tree builder
+  parser.setHandler(nullptr);
+  ASSERT_TRUE(parser.parseAll(R"({"items": [{"id": 3}], "other": 1})"));
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"items":[{"id":3}]})");
+}
+
+TEST(MultiDocument, EmitsEachRecord)
+{
+  const std::string_view input = "{\"id\": 1, \"x\": \"a\"}\n{\"id\": 2, \"x\": [1, 2]}\n\n[3]\"s\" 4\ntrue{\"id\": 5}\n";
+  for (size_t chunk : {size_t{1}, size_t{3}, input.size()})
+  {
+    auto filter = Filter::from_string(".id");
+    ASSERT_TRUE(filter);
+    std::vector<std::string> records;
+    Parser parser{*filter};
+    parser.setMultiDocument(true, [&](Value &root) { records.push_back(root.stringify(-1)); });
+    for (size_t i = 0; i < input.size(); i += chunk)
+      parser.parseContinue(input.substr(i, chunk));
+    parser.finish();
+    EXPECT_TRUE(parser.isValid());
+    // the filter applies to every record, it keeps no array elements and scalars whole
+    EXPECT_EQ(records, (std::vector<std::string>{R"({"id":1})", R"({"id":2})", "[]", R"("s")", "4", "true", R"({"id":5})"}))
+        << "chunk " << chunk;
+  }
+}
+
+TEST(MultiDocument, HandlerSeesDocumentEnds)
+{
+  struct Counter : Handler
+  {
+    int documents = 0, numbers = 0;
+    void onNumber(Number) override { numbers++; }
+    void onDocumentEnd() override { documents++; }
+  } counter;
+  Parser parser{counter};
+  parser.setMultiDocument(true);
+  ASSERT_TRUE(parser.parseAll("[1, 2]\n{\"a\": 3}\n4 5"));
+  EXPECT_EQ(counter.documents, 4);
+  EXPECT_EQ(counter.numbers, 5);
+}
+
+TEST(ParallelParser, OrderedOutputForAnyThreadCount)
+{
+  std::string input;
+  for (int i = 0; i < 2000; i++)
+    input += "{\"id\": " + std::to_string(i) + ", \"pad\": \"" + std::string(i % 37, 'x') + "\"}\n";
+  auto filter = Filter::from_string(".id");
+  ASSERT_TRUE(filter);
+  std::string expected;
+  for (int i = 0; i < 2000; i++)
+    expected += "{\"id\":" + std::to_string(i) + "}\n";
+  for (unsigned threads : {1u, 2u, 8u})
+  {
+    // small chunks and a small window so workers wait on the output
+    ParallelParser parallel{filter.get(), threads, 512, 3};
+    BufferWriter out;
+    EXPECT_TRUE(parallel.parse(input, out));
+    EXPECT_EQ(out.view(), expected) << threads << " threads";
+  }
+}
+
+TEST(ParallelParser, SplitsOneHugeArray)
+{
+  // strings full of brackets, commas, quotes and escapes so a range may start anywhere
+  std::string input = "  [";
+  for (int i = 0; i < 3000; i++)
+  {
+    if (i)
+      input += i % 7 ? "," : " ,\n ";
+    if (i % 3 == 0)
+      input += "{\"id\": " + std::to_string(i) + ", \"s\": \"],[{\\\"\\\\\", \"a\": [" + std::to_string(i) + ", {}]}";
+    else if (i % 3 == 1)
+      input += "\"x\\\\\\\"" + std::string(i % 11, ',') + "\"";
+    else
+      input += "[[" + std::to_string(i) + "], null]";
+  }
+  input += "] \n";
+  Parser sequential;
+  ASSERT_TRUE(sequential.parseAll(input));
+  std::string expected = sequential.getValue().stringify(-1);
+  for (unsigned threads : {2u, 3u, 8u})
+  {
+    ParallelParser parallel{nullptr, threads, 64};
+    Document document;
+    ASSERT_TRUE(parallel.parseArray(input, document)) << threads << " threads";
+    EXPECT_EQ(document.root().stringify(-1), expected) << threads << " threads";
+  }
+
+  // filters see the element indices of the whole array
+  ArrayFilter filter;
+  filter.add(2, std::make_unique<Identity>());
+  filter.add(2999, std::make_unique<Identity>());
+  ParallelParser parallel{&filter, 4, 64};
+  Document document;
+  ASSERT_TRUE(parallel.parseArray(input, document));
+  EXPECT_EQ(document.root().stringify(-1), "[[[2],null],[[2999],null]]");
+}
+
+TEST(ParallelParser, ParsesArraysTheFilterLimits)
+{
+  std::string input = "[";
+  for (int i = 0; i < 4000; i++)
+    input += (i ? ", " : "") + std::to_string(i);
+  input += "]";
+  // an object filter keeps no element, an index ends the array after it
+  ObjectFilter object;
+  object.add("a", std::make_unique<Identity>());
+  auto index = Filter::from_string(".[1500]");
+  ASSERT_TRUE(index);
+  const Filter *filters[] = {&object, index.get()};
+  for (const Filter *filter : filters)
+  {
+    Parser sequential{*filter};
+    ASSERT_TRUE(sequential.parseAll(input));
+    ParallelParser parallel{filter, 4, 1024};
+    Document document;
+    ASSERT_TRUE(parallel.parseArray(input, document));
+    EXPECT_EQ(document.root().stringify(-1), sequential.getValue().stringify(-1));
+  }
+}
+
+TEST(ParallelParser, SelectsTheRootArrayAsAWhole)
+{
+  std::string input = "[";
+  for (int i = 0; i < 4000; i++)
+    input += (i ? ", " : "") + std::to_string(i);
+  input += "]";
+  // an array has no key a, so its predicate sees null and drops or keeps the whole root
+  for (const char *expression : {"select(.a == 1) | .[]", "select(.a != 1) | .[]"})
+  {
+    auto filter = Filter::from_string(expression);
+    ASSERT_TRUE(filter);
+    Parser sequential{*filter};
+    ASSERT_TRUE(sequential.parseAll(input));
+    ParallelParser parallel{filter.get(), 4, 1024};
+    Document document;
+    ASSERT_TRUE(parallel.parseArray(input, document)) << expression;
+    EXPECT_EQ(document.root().stringify(-1), sequential.getValue().stringify(-1)) << expression;
+  }
+}
+
+TEST(ParserFile, MapsRegularFilesAndReadsPipes)
+{
+  std::string path = ::testing::TempDir() + "filteredjson_parse_file.json";
+  {
+    std::ofstream out{path, std::ios::binary};
+    out << R"({"name": "mapped", "list": [1, 2, 3]})";
+  }
+  Parser parser;
+  ASSERT_TRUE(parser.parseFile(path));
+  // unescaped strings view the mapping
+  const String &name = parser.getValue().toObject()["name"].toString();
+  EXPECT_EQ(name.isView(), bool(POSIX_FILES));
+  EXPECT_EQ(name, "mapped");
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"name":"mapped","list":[1,2,3]})");
+  std::remove(path.c_str());
+
+  EXPECT_FALSE(parser.parseFile(path));
+
+#if POSIX_FILES
+  // a fifo can't be mapped and is read in blocks instead
+  std::string fifo = ::testing::TempDir() + "filteredjson_parse_fifo";
+  std::remove(fifo.c_str());
+  ASSERT_EQ(mkfifo(fifo.c_str(), 0600), 0);
+  std::thread writer{[&] {
+    std::ofstream out{fifo, std::ios::binary};
+    out << "[\"piped\", {\"x\": null}]";
+  }};
+  // joined before an ASSERT can return
+  bool parsed = parser.parseFile(fifo);
+  writer.join();
+  std::remove(fifo.c_str());
+  ASSERT_TRUE(parsed);
+  EXPECT_EQ(parser.getValue().stringify(-1), R"(["piped",{"x":null}])");
+#endif
+}
+
+TEST(LazyDocument, MaterializesOnlyVisitedValues)
+{
+  const std::string input = R"( {"skip": [1, {"deep": "]"}, "x\"}"], "n": -1.5e2,
+    "items": [{"id": 1, "tags": ["a", "b"]}, {"id": 2}, {}], "escAped": "v\\w", "t": true, "z": null, "k\u0065y": 7} )";
+  LazyDocument lazy;
+  ASSERT_TRUE(lazy.parse(input));
+  LazyValue root = lazy.root();
+  EXPECT_EQ(root.getType(), Type::Object);
+  EXPECT_EQ(root.size(), 7u);
+  EXPECT_EQ(root["items"].size(), 3u);
+  EXPECT_EQ(root["items"][1]["id"].get().toNumber().asInteger(), 2);
+  EXPECT_EQ(root["items"][0]["tags"][1].get().toString(), "b");
+  EXPECT_EQ(root["items"][0].raw(), R"({"id": 1, "tags": ["a", "b"]})");
+  EXPECT_EQ(root["items"][2].size(), 0u);
+  EXPECT_FALSE(root["items"][3].exists());
+  EXPECT_FALSE(root["missing"].exists());
+  EXPECT_EQ(root["n"].get().toNumber().asDouble(), -150.0);
+  EXPECT_EQ(root["escAped"].get().toString(), "v\\w");
+  EXPECT_TRUE(root["t"].get().toBoolean());
+  EXPECT_EQ(root["z"].getType(), Type::Null);
+  EXPECT_EQ(root["key"].raw(), "7");
+  EXPECT_EQ(root["items"][0].get().stringify(-1), R"({"id":1,"tags":["a","b"]})");
+  // the same value is only parsed once
+  EXPECT_EQ(&root["n"].get(), &root["n"].get());
+
+  EXPECT_FALSE(lazy.parse(R"({"a": [1, 2})"));
+  EXPECT_FALSE(lazy.parse("[1] [2]"));
+  // separators, keys and scalars are checked as well
+  for (std::string_view invalid : {"[1 2]", R"({"a" "b"})", "[,]", "[tru]", "[1,]", R"({"a": 1,})", R"({"a"})",
+                                   R"({1: 2})", R"({"a": 1 "b": 2})", "[01]", "[1.]", "[-]", "[1e]", R"(["\x"])",
+                                   R"(["\u12g4"])", "", "[1]]", R"({"a": 1])"})
+  {
+    EXPECT_FALSE(lazy.parse(invalid)) << invalid;
+  }
+  for (std::string_view valid : {"[]", "{}", " 12 ", R"(["\"\\\/\b\f\n\r\té", -0.5e+3, null, {"a": [true, false]}])"})
+  {
+    EXPECT_TRUE(lazy.parse(valid)) << valid;
+  }
+}
+
+TEST(ParserEarlyExit, StopsOnceTheFilterIsSatisfied)
+{
+  std::string input = R"({"header": {"id": 7, "v": 1}, "items": [)";
+  for (int i = 0; i < 1000; i++)
+    input += "{\"id\": " + std::to_string(i) + "},";
+  input += "{}]}";
+
+  auto filter = Filter::from_string(".header.id");
+  Parser parser{*filter};
+  Parser::Status status = parser.parseContinue(input);
+  EXPECT_TRUE(status.done);
+  EXPECT_LT(status.consumed, 40u);
+  EXPECT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"header":{"id":7}})");
+
+  // later chunks are ignored, also when fed a byte at a time
+  parser.reset();
+  parseBytewise(parser, input);
+  EXPECT_TRUE(parser.isDone());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"header":{"id":7}})");
+
+  filter = Filter::from_string(".items[1]");
+  parser.setFilter(filter.get());
+  status = parser.parseContinue(input);
+  EXPECT_TRUE(status.done);
+  EXPECT_LT(status.consumed, 80u);
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"items":[{"id":1}]})");
+}
+
+TEST(ParserEarlyExit, SkipsTheRestOfInnerContainers)
+{
+  const std::string_view input = R"({"a": [[1, 2, 3], {"x": 1, "y": [4], "z": 5}, 6], "b": {"x": 2, "w": 3}, "c": 7})";
+  auto filter = Filter::from_string(".a[0][1], .a[1].x, .b.x");
+  Parser parser{*filter};
+  parseBytewise(parser, input);
+  parser.finish();
+  EXPECT_TRUE(parser.isValid());
+  EXPECT_TRUE(parser.isDone());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"a":[[2],{"x":1}],"b":{"x":2}})");
+
+  std::vector<std::string> records;
+  parser.setMultiDocument(true, [&](Value &root) { records.push_back(root.stringify(-1)); });
+  filter = Filter::from_string(".id");
+  parser.setFilter(filter.get());
+  parser.parseContinue(R"({"id": 1, "x": {"}": "]"}} {"y": [], "id": 2, "z": 3}
+{"id": 3})");
+  EXPECT_TRUE(parser.isValid());
+  EXPECT_EQ(records, (std::vector<std::string>{R"({"id":1})", R"({"id":2})", R"({"id":3})"}));
+}
+
+TEST(StaticFilter, MatchesCompiledFilter)
+{
+  const std::string_view input = R"({"items": [{"id": 1, "x": 2}, {"x": 3, "id": 4}, {"y": [5]}],
+    "meta": {"ts": 123, "tz": "utc"}, "id": 6, "m": {"ts": 0}})";
+  EXPECT_EQ(parseFiltered(static_filter<"items[].id", "meta.ts">, input),
+            parseFiltered(*Filter::from_string(".items[].id, .meta.ts"), input));
+  EXPECT_EQ(parseFiltered(static_filter<".items[].id", ".items[1].x", "meta">, input),
+            R"({"items":[{"id":1},{"x":3,"id":4},{}],"meta":{"ts":123,"tz":"utc"}})");
+  EXPECT_EQ(parseFiltered(static_filter<"items[2].y[0]", "id">, input), R"({"items":[{"y":[5]}],"id":6})");
+  EXPECT_EQ(parseFiltered(static_filter<"">, input), parseFiltered(Identity{}, input));
+  EXPECT_EQ(parseFiltered(static_filter<"[1]">, "[1, 2, 3]"), "[2]");
+}
+
+TEST(StaticFilter, HashesManyKeys)
+{
+  const Filter &filter = static_filter<"k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9", "alpha", "beta", "gamma">;
+  EXPECT_EQ(filter.keyLimit(), 13);
+  for (std::string_view key : {"k0", "k5", "k9", "alpha", "beta", "gamma"})
+    EXPECT_NE(filter.keepKey(key), nullptr) << key;
+  for (std::string_view key : {"k", "k10", "ka", "alphA", "", "delta", "gamm"})
+    EXPECT_EQ(filter.keepKey(key), nullptr) << key;
+  EXPECT_EQ(filter.keepIdx(0), nullptr);
+  EXPECT_EQ(filter.indexLimit(), 0);
+}
+
+TEST(ObjectFilter, MatchesKeysOfEverySetSize)
+{
+  // keys are added one at a time, as the compiler does, so large sets build quickly too
+  for (size_t count : {1u, 4u, 12u, 40u, 100u, 20000u})
+  {
+    ObjectFilter filter;
+    size_t longest = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      std::string key = "key_" + std::to_string(i) + std::string(i % 3 * 7, 'x');
+      filter.add(key, std::make_unique<Identity>());
+      longest = std::max(longest, key.size());
+    }
+    for (size_t i = 0; i < count; i++)
+      EXPECT_NE(filter.keepKey("key_" + std::to_string(i) + std::string(i % 3 * 7, 'x')), nullptr) << count << " " << i;
+    // near misses of the keys, none of them in any of the sets
+    for (std::string_view key : {"", "key_", "key_0x", "key_1", "key_2xxxxxxxxxxxxx", "kez_0", "other", "Key_0",
+                                 "key_1xxxxxxy", "key_99x", "key_100", "key_4xxxxxx"})
+    {
+      EXPECT_EQ(filter.keepKey(key), nullptr) << count << " " << key;
+    }
+    EXPECT_EQ(filter.keyPrefilter()->maxLength, longest);
+    // adding a key again replaces its filter
+    auto replacement = std::make_unique<Identity>();
+    const Filter *expected = replacement.get();
+    filter.add("key_0", std::move(replacement));
+    EXPECT_EQ(filter.keepKey("key_0"), expected) << count;
+    EXPECT_EQ(filter.keyLimit(), int(count)) << count;
+  }
+}
+
+TEST(ParserFilter, RejectsKeysWhileReadingThem)
+{
+  const std::string_view input = R"({"zebra": 1, "abcdefgh": 2, "ab": 3, "x\u0061": 4, "a\u0062c": 5, "": 6})";
+  ObjectFilter filter;
+  filter.add("abc", std::make_unique<Identity>());
+  filter.add("ab", std::make_unique<Identity>());
+  filter.add("", std::make_unique<Identity>());
+  for (bool bytewise : {false, true})
+  {
+    Parser parser{filter};
+    if (bytewise)
+      parseBytewise(parser, input);
+    else
+      parser.parseContinue(input);
+    ASSERT_TRUE(parser.isValid());
+    EXPECT_EQ(parser.getValue().stringify(-1), R"({"ab":3,"abc":5,"":6})");
+  }
+  EXPECT_EQ(parseFiltered(static_filter<"abc", "ab">, input), R"({"ab":3,"abc":5})");
+}
+
+TEST(ParserStats, CountsWhenEnabled)
+{
+  auto filter = Filter::from_string(".a, .c");
+  Parser parser{*filter};
+  parser.parseContinue(R"({"a": [1, {"b": "x"}],)");
+  parser.parseContinue(R"( "skipped": [[[1, 2]]], "c": 3})");
+  ASSERT_TRUE(parser.isValid());
+  Parser::Stats stats = parser.stats();
+  if (!Parser::statsEnabled)
+  {
+    EXPECT_EQ(stats.bytes, 0u);
+    EXPECT_EQ(stats.chunks, 0u);
+    return;
+  }
+  EXPECT_EQ(stats.chunks, 2u);
+  EXPECT_EQ(stats.bytes, 52u); // the closing brace is left unread
+  EXPECT_EQ(stats.skippedBytes, 11u);
+  EXPECT_EQ(stats.keptBytes, stats.bytes - stats.skippedBytes);
+  EXPECT_EQ(stats.values, 6u);
+  EXPECT_EQ(stats.maxDepth, 3u);
+  size_t total = 0;
+  for (size_t s = 0; s < Parser::stateCount; s++)
+    total += stats.stateBytes[s];
+  EXPECT_EQ(total, stats.bytes);
+  EXPECT_STREQ(Parser::stateName(0), "Start");
+  parser.clearStats();
+  EXPECT_EQ(parser.stats().bytes, 0u);
+}
+
+TEST(ParserErrors, InvalidInputFailsWithoutAborting)
+{
+  for (bool indexed : {false, true})
+  {
+    for (std::string_view input : {"[tru, 1]", "{\"a\" 1}", "[1 2]", "nul", "{\"a\": x}", "[1]]", "{,}", "[1, x]"})
+    {
+      Parser parser;
+      parser.useStructuralIndex(indexed);
+      parser.parseContinue(input);
+      parser.finish();
+      EXPECT_FALSE(parser.isValid()) << input << " indexed " << indexed;
+      // a reset parser is usable again
+      parser.reset();
+      parser.parseContinue("[true]");
+      parser.finish();
+      EXPECT_TRUE(parser.isValid()) << input << " indexed " << indexed;
+    }
+  }
+}
+
+TEST(ParserErrors, LimitsNestingDepth)
+{
+  Parser parser;
+  std::string ok = std::string(Parser::maxDepth, '[') + std::string(Parser::maxDepth, ']');
+  parser.parseContinue(ok);
+  EXPECT_TRUE(parser.isValid());
+
+  parser.reset();
+  parser.parseContinue("[" + ok + "]");
+  EXPECT_FALSE(parser.isValid());
+
+  std::string objects;
+  for (size_t i = 0; i < Parser::maxDepth; i++)
+    objects += "{\"k\": ";
+  objects += "\"\\u00e9\"" + std::string(Parser::maxDepth, '}');
+  parser.reset();
+  parseBytewise(parser, objects);
+  EXPECT_TRUE(parser.isValid());
+
+  // skipped values aren't built, so they may nest deeper
+  auto filter = Filter::from_string(".a");
+  parser.setFilter(filter.get());
+  parser.reset();
+  parser.parseContinue("{\"b\": [" + ok + "], \"a\": [null, false]}");
+  EXPECT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"a":[null,false]})");
+
+  parser.reset();
+  parseBytewise(parser, R"({"a": [true, false, null], "b": 1})");
+  EXPECT_TRUE(parser.isValid());
+  EXPECT_EQ(parser.getValue().stringify(-1), R"({"a":[true,false,null]})");
+}
+
+TEST(SelectFilter, KeepsValuesMeetingEveryPredicate)
+{
+  const std::string_view input = R"([{"level": "info", "n": 3, "msg": "a"},
+    {"msg": "b\n", "n": 12, "level": "error", "tags": ["x"]},
+    {"level": "error", "n": 2.5, "msg": "c", "user": {"id": 250075927172759552}},
+    {"level": "error", "n": 7, "user": {"id": 250075927172759553, "name": "d"}},
+    "error", null])";
+  struct Case
+  {
+    const char *filter;
+    const char *kept;
+  };
+  for (Case c : {Case{R"(.[] | select(.level == "error") | {msg})", R"([{"msg":"b\n"},{"msg":"c"},{}])"},
+                 Case{R"(.[] | select(.n >= 3 and .level != "info") | .n)", R"([{"n":12},{"n":7}])"},
+                 Case{R"(.[] | select(.user.id == 250075927172759552) | .msg)", R"([{"msg":"c"}])"},
+                 Case{R"(.[] | select(.msg | startswith("b")) | .tags)", R"([{"tags":["x"]}])"},
+                 Case{R"(.[] | select(.user) | select(.n < 3))", R"([{"level":"error","n":2.5,"msg":"c","user":{"id":250075927172759552}}])"},
+                 Case{R"(.[] | select(. == "error"))", R"(["error"])"},
+                 Case{R"(.[] | select(.missing == null) | .level)", R"([{"level":"info"},{"level":"error"},{"level":"error"},{"level":"error"},"error",null])"}})
+  {
+    auto filter = Filter::from_string(c.filter);
+    ASSERT_TRUE(filter) << c.filter;
+    Parser parser{*filter};
+    ASSERT_TRUE(parser.parseAll(input)) << c.filter;
+    EXPECT_EQ(parser.getValue().stringify(-1), c.kept) << c.filter;
+    // strings held back across chunks are copied
+    parser.reset();
+    parseBytewise(parser, input);
+    ASSERT_TRUE(parser.isValid()) << c.filter;
+    EXPECT_EQ(parser.getValue().stringify(-1), c.kept) << c.filter;
+  }
+  // a value is selected one way only
+  EXPECT_FALSE(Filter::from_string("(.[] | select(.a == 1)), (.[] | .b)"));
+  EXPECT_FALSE(Filter::from_string(".[] | select(.a[0] == 1)"));
+  EXPECT_FALSE(Filter::from_string(".[] | select(.a ==)"));
+  EXPECT_TRUE(Filter::from_string("(.[] | select(.a == 1)), .[]"));
+}
+
+TEST(SelectFilter, DropsRecordsWithoutRaisingEvents)
+{
+  std::string input;
+  for (int i = 0; i < 100; i++)
+    input += R"({"level": ")" + std::string(i % 10 ? "debug" : "error") + R"(", "tenant": )" + std::to_string(i % 3) +
+             R"(, "body": {"text": "line )" + std::to_string(i) + R"(", "list": [1, [2, {"x": "}"}]]}})" + "\n";
+  auto filter = Filter::from_string(R"(select(.level == "error" and .tenant != 1) | .body.text)");
+  ASSERT_TRUE(filter);
+
+  TraceHandler handler;
+  Parser parser{handler, *filter};
+  parser.setMultiDocument(true);
+  ASSERT_TRUE(parser.parseAll(input));
+  EXPECT_EQ(handler.trace, "{body:{text:'line 0' }}{body:{text:'line 20' }}{body:{text:'line 30' }}"
+                           "{body:{text:'line 50' }}{body:{text:'line 60' }}{body:{text:'line 80' }}"
+                           "{body:{text:'line 90' }}");
+
+  std::vector<std::string> records;
+  Parser builder{*filter};
+  builder.setMultiDocument(true, [&](Value &root) { records.push_back(root.stringify(-1)); });
+  for (size_t i = 0; i < input.size(); i += 7)
+    builder.parseContinue(std::string_view{input}.substr(i, 7));
+  builder.finish();
+  EXPECT_TRUE(builder.isValid());
+  ASSERT_EQ(records.size(), 7u);
+  EXPECT_EQ(records[1], R"({"body":{"text":"line 20"}})");
+
+  // a dropped root ends a single document
+  Parser single{*filter};
+  Parser::Status status = single.parseContinue(R"({"level": "debug", "body": {"text": "x"}, "tenant": 0})");
+  EXPECT_TRUE(status.done);
+  EXPECT_LT(status.consumed, 20u);
+  EXPECT_TRUE(single.getValue().isNull());
+}
+
+TEST(FanOut, EachConsumerSeesItsOwnFilter)
+{
+  const std::string_view input = R"({"items": [{"id": 1, "name": "a", "tags": ["x", "y"]}, {"id": 2, "name": "b\n"}],
+    "meta": {"ts": 7, "host": "h"}, "big": [1, 2, 3, {"deep": [[[]]]}]})";
+  const char *expressions[] = {".items[].id", ".meta.ts", ".items[1], .meta", ".items[] | select(.id == 2) | {name}", "."};
+  FanOut fanout;
+  std::vector<std::unique_ptr<Filter>> filters;
+  std::vector<TraceHandler> traces(std::size(expressions));
+  for (size_t i = 0; i < std::size(expressions); i++)
+  {
+    filters.push_back(Filter::from_string(expressions[i]));
+    ASSERT_TRUE(filters.back()) << expressions[i];
+    fanout.add(filters.back().get(), traces[i]);
+  }
+  for (bool bytewise : {false, true})
+  {
+    for (TraceHandler &trace : traces)
+      trace.trace.clear();
+    if (bytewise)
+    {
+      fanout.reset();
+      for (size_t i = 0; i < input.size(); i++)
+        fanout.parseContinue(input.substr(i, 1));
+      fanout.finish();
+    }
+    else
+    {
+      fanout.parseAll(input);
+    }
+    EXPECT_TRUE(fanout.isValid());
+    for (size_t i = 0; i < std::size(expressions); i++)
+    {
+      // the same events as a parser of its own
+      TraceHandler alone;
+      Parser parser{alone, *filters[i]};
+      ASSERT_TRUE(parser.parseAll(input));
+      EXPECT_EQ(traces[i].trace, alone.trace) << expressions[i];
+    }
+  }
+  EXPECT_EQ(traces[3].trace, "{items:[{name:'b\n' }]}");
+}
+
+TEST(FanOut, SkipsWhatNoConsumerKeeps)
+{
+  std::string input;
+  for (int i = 0; i < 50; i++)
+    input += R"({"level": ")" + std::string(i % 5 ? "info" : "error") + R"(", "id": )" + std::to_string(i) +
+             R"(, "payload": {"text": "}]", "list": [1, 2, 3]}})" + "\n";
+  auto errors = Filter::from_string(R"(select(.level == "error") | .id)");
+  auto ids = Filter::from_string(".id");
+  ASSERT_TRUE(errors && ids);
+  struct Counter : Handler
+  {
+    int numbers = 0, documents = 0;
+    void onNumber(Number) override { numbers++; }
+    void onDocumentEnd() override { documents++; }
+  } errorCount, idCount;
+  FanOut fanout;
+  fanout.add(errors.get(), errorCount);
+  fanout.add(ids.get(), idCount);
+  fanout.setMultiDocument(true);
+  ASSERT_TRUE(fanout.parseAll(input));
+  EXPECT_EQ(errorCount.numbers, 10);
+  EXPECT_EQ(errorCount.documents, 10);
+  EXPECT_EQ(idCount.numbers, 50);
+  EXPECT_EQ(idCount.documents, 50);
+
+  // once every consumer has what it keeps the rest is never read
+  auto first = Filter::from_string(".[0]");
+  auto second = Filter::from_string(".[1].a");
+  TraceHandler a, b;
+  FanOut pair;
+  pair.add(first.get(), a);
+  pair.add(second.get(), b);
+  Parser::Status status = pair.parseContinue(R"([1, {"a": 2, "b": 3}, "not read", [)");
+  EXPECT_TRUE(status.done);
+  EXPECT_EQ(a.trace, "[1 ]");
+  EXPECT_EQ(b.trace, "[{a:2 }]");
+}
+
+TEST(Passthrough, CopiesKeptValuesByteForByte)
+{
+  struct Case
+  {
+    const char *filter, *input, *output;
+  } cases[] = {
+    {".id, .user, .n",
+     R"({"id": 1.50e3, "drop": [1, {"x": "}"}], "user": {"name": "\u00e9 \"q\"", "tags" : [ "a" ,2 ], "z": 1, "a": 2}, "n": -0, "rest": [)",
+     "{\"id\":1.50e3,\"user\":{\"name\": \"\\u00e9 \\\"q\\\"\", \"tags\" : [ \"a\" ,2 ], \"z\": 1, \"a\": 2},\"n\":-0}\n"},
+    {".items[].id, .meta",
+     R"({"items": [{"id": "a\/b", "x": 1}, {"id": 2E+1}], "meta": {"ts": 1e3}})",
+     "{\"items\":[{\"id\":\"a\\/b\"},{\"id\":2E+1}],\"meta\":{\"ts\": 1e3}}\n"},
+  };
+  for (const Case &c : cases)
+  {
+    auto filter = Filter::from_string(c.filter);
+    ASSERT_TRUE(filter);
+    for (int mode = 0; mode < 3; mode++)
+    {
+      BufferWriter out;
+      Parser parser{*filter};
+      parser.useStructuralIndex(mode == 2);
+      parser.setPassthrough(&out);
+      if (mode == 1)
+      {
+        parseBytewise(parser, c.input);
+        parser.finish();
+      }
+      else
+      {
+        parser.parseAll(c.input);
+      }
+      EXPECT_TRUE(parser.isValid()) << c.filter << " mode " << mode;
+      EXPECT_EQ(out.view(), c.output) << c.filter << " mode " << mode;
+    }
+  }
+}
+
+TEST(Passthrough, WritesEachRecordAndSelectedValues)
+{
+  BufferWriter out;
+  Parser parser;
+  parser.setMultiDocument(true);
+  parser.setPassthrough(&out);
+  ASSERT_TRUE(parser.parseAll("1 \"x\"\n[1,  2]\n{}"));
+  EXPECT_EQ(out.view(), "1\n\"x\"\n[1,  2]\n{}\n");
+
+  // a select() is decided from the events, so its values are written from them
+  auto filter = Filter::from_string(R"(select(.level == "error") | {ts, msg})");
+  ASSERT_TRUE(filter);
+  out.clear();
+  parser.setFilter(filter.get());
+  ASSERT_TRUE(parser.parseAll("{\"level\": \"error\", \"ts\": 10, \"msg\": \"a\\tb\"}\n"
+                              "{\"level\": \"info\", \"ts\": 11, \"msg\": \"c\"}\n"));
+  EXPECT_EQ(out.view(), "{\"ts\":10,\"msg\":\"a\\tb\"}\n");
+
+  // and without a Writer the tree is built again
+  parser.setPassthrough(nullptr);
+  parser.setMultiDocument(false);
+  parser.setFilter(nullptr);
+  ASSERT_TRUE(parser.parseAll(R"([1.50e3])"));
+  EXPECT_EQ(parser.getValue().stringify(-1), "[1500.0]");
+}